@@ -0,0 +1,49 @@
+#ifndef JOS_BOOT_BOOT_H
+#define JOS_BOOT_BOOT_H
+
+/*
+ * Definitions shared by the two stages of the boot loader.
+ *
+ * DISK LAYOUT
+ *  sector 0			boot block (boot.S, main.c, disk.c)
+ *  sectors 1..BOOT2_NSECT	stage 2 (boot2.S, main2.c, disk.c, lz4.c)
+ *  sectors KERN_SECT..		kernel image: ELF, or compressed (zkern.h)
+ *
+ * BOOT2_NSECT and KERN_SECT come from boot/Makefrag, which also lays
+ * out the disk image.
+ */
+
+#define SECTSIZE	512
+#define MAXSECTS	256	// sectors per READ SECTORS command (count 0 = 256)
+
+// Stage 2 is loaded right after the boot block, below the ELF scratch page.
+#define BOOT2_ADDR	0x7E00
+
+// While still in real mode, the boot block reads up to EDD_MAXSECT
+// sectors of the kernel image to EDD_BOUNCE with BIOS extended reads
+// (INT 13h AH=42h).  Stage 2 copies what it needs from there and
+// reads anything else with PIO.
+#define EDD_BOUNCE	0x10000
+#define EDD_MAXSECT	1024	// up to 0x90000, clear of the EBDA
+
+// The size of the kernel image in sectors is patched into the boot
+// block at this offset when the disk image is built (boot/setnsect.pl).
+// Zero means unknown.
+#define KERN_NSECT_OFF	508
+
+#ifndef __ASSEMBLER__
+
+#include <inc/types.h>
+
+// boot/disk.c
+void waitdisk(void);
+void readsect(void *dst, uint32_t offset, uint32_t nsect);
+void readsect_issue(uint32_t offset, uint32_t nsect);
+void readsect_drain(void *dst, uint32_t nsect);
+
+// boot/lz4.c
+uint32_t lz4_decompress(uint8_t *dst, const uint8_t *src, uint32_t zsize);
+
+#endif /* !__ASSEMBLER__ */
+
+#endif /* !JOS_BOOT_BOOT_H */
@@ -0,0 +1,53 @@
+#include <inc/x86.h>
+
+#include <boot/boot.h>
+
+// Polled IDE disk access shared by both boot loader stages.
+
+void
+waitdisk(void)
+{
+	// wait for disk reaady
+	while ((inb(0x1F7) & 0xC0) != 0x40)
+		/* do nothing */;
+}
+
+// Read 'nsect' (1..MAXSECTS) consecutive sectors starting at sector
+// 'offset' into 'dst' with a single READ SECTORS command.
+void
+readsect(void *dst, uint32_t offset, uint32_t nsect)
+{
+	readsect_issue(offset, nsect);
+	readsect_drain(dst, nsect);
+}
+
+// Start a READ SECTORS command for 'nsect' sectors at 'offset' and
+// return while the drive works on it.
+void
+readsect_issue(uint32_t offset, uint32_t nsect)
+{
+	// wait for disk to be ready
+	waitdisk();
+
+	outb(0x1F2, nsect);	// count = nsect (256 is sent as 0)
+	outb(0x1F3, offset);
+	outb(0x1F4, offset >> 8);
+	outb(0x1F5, offset >> 16);
+	outb(0x1F6, (offset >> 24) | 0xE0);
+	outb(0x1F7, 0x20);	// cmd 0x20 - read sectors
+}
+
+// Copy the data of the command started by readsect_issue into 'dst'.
+void
+readsect_drain(void *dst, uint32_t nsect)
+{
+	// The drive raises DRQ once per sector; drain each one
+	// as soon as it is ready.
+	while (nsect-- > 0) {
+		// wait for BSY clear and DRQ set
+		while ((inb(0x1F7) & 0x88) != 0x08)
+			/* do nothing */;
+		insl(0x1F0, dst, SECTSIZE/4);
+		dst += SECTSIZE;
+	}
+}
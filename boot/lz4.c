@@ -0,0 +1,49 @@
+#include <inc/types.h>
+
+#include <boot/boot.h>
+
+// Decompress the raw LZ4 block of 'zsize' bytes at 'src' into 'dst'.
+// Returns the number of bytes written.  The block is trusted: this
+// only runs on the image the build system produced.
+uint32_t
+lz4_decompress(uint8_t *dst, const uint8_t *src, uint32_t zsize)
+{
+	const uint8_t *end, *match;
+	uint8_t *d, token, b;
+	uint32_t len;
+
+	end = src + zsize;
+	d = dst;
+	while (src < end) {
+		token = *src++;
+
+		// literal run; a length nibble of 15 continues in later bytes
+		len = token >> 4;
+		if (len == 15)
+			do {
+				b = *src++;
+				len += b;
+			} while (b == 255);
+		while (len-- > 0)
+			*d++ = *src++;
+
+		// the last sequence has literals only
+		if (src >= end)
+			break;
+
+		// match: 16-bit little-endian offset back into the output
+		match = d - (src[0] | (src[1] << 8));
+		src += 2;
+		len = token & 15;
+		if (len == 15)
+			do {
+				b = *src++;
+				len += b;
+			} while (b == 255);
+		len += 4;
+		// copy byte by byte, since the match may overlap its output
+		while (len-- > 0)
+			*d++ = *match++;
+	}
+	return d - dst;
+}
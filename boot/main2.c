@@ -0,0 +1,285 @@
+#include <inc/x86.h>
+#include <inc/elf.h>
+#include <inc/bootinfo.h>
+
+#include <boot/boot.h>
+#include <boot/zkern.h>
+
+/**********************************************************************
+ * Second stage of the boot loader.
+ *
+ * The boot block (boot.S, main.c) has switched to protected mode and
+ * loaded this code from the sectors right after it.  Not being
+ * squeezed into 510 bytes, this is where smarter loading belongs.
+ *
+ * boot2main() reads the kernel image from sector KERN_SECT onward,
+ * loads each program segment to its physical address and jumps to
+ * the kernel's entry point.  The image is either the ELF kernel
+ * itself or a compressed image (see zkern.h), which is read whole
+ * into low memory and decompressed segment by segment.
+ *
+ * The image is staged in the scratch area at EDD_BOUNCE, where the
+ * boot block may already have put its start with BIOS calls.  The rest
+ * streams in with pipelined PIO (see img_need): as soon as one command's
+ * data has been drained, the next command is issued, so the drive reads
+ * ahead while we parse headers, copy, decompress and zero segments.
+ * Anything that does not fit in the scratch area is read with readseg.
+ *
+ * The boot block leaves A20 to us, since it never touches memory
+ * above 1MB.
+ *
+ * The boot block has stamped its entry in the Bootinfo block; we add
+ * a stamp for A20 and one per loaded segment.
+ **********************************************************************/
+
+#define SCRATCH		EDD_BOUNCE
+#define SCRATCH_NSECT	EDD_MAXSECT
+#define ELFHDR		((struct Elf *) SCRATCH)
+#define ZKERN		((struct Zkern *) SCRATCH)
+#define BI		((struct Bootinfo *) BOOTINFO)
+#define KERN_NSECT	(*(uint16_t *) (0x7C00 + KERN_NSECT_OFF))
+
+void readseg(uint32_t, uint32_t, uint32_t);
+static void enable_a20(void);
+static int img_need(uint32_t);
+static void img_idle(void);
+static void copyseg(uint32_t, uint32_t, uint32_t);
+static void zeroseg(uint32_t, uint32_t);
+static void stampseg(void);
+static void load_zkern(void);
+
+// State of the image in the scratch area, in sectors.
+static uint32_t img_have;	// read so far
+static uint32_t img_nsect;	// to read in total
+static uint32_t img_busy;	// being read by the command in flight
+
+void
+boot2main(void)
+{
+	struct Proghdr *ph, *eph;
+	uint32_t end;
+
+	BI->bi_magic = BOOTINFO_MAGIC;
+	BI->bi_nseg = 0;
+
+	enable_a20();
+	BI->bi_tsc[BOOTPH_A20] = read_tsc();
+
+	// Stage as much of the image as fits; if its size is unknown,
+	// just the first page.
+	img_nsect = KERN_NSECT ? MIN(KERN_NSECT, SCRATCH_NSECT) : 8;
+	img_have = MIN(BI->bi_edd_nsect, img_nsect);
+
+	// read 1st page off disk
+	img_need(MIN(img_nsect, 8) * SECTSIZE);
+
+	// compressed image?
+	if (ZKERN->zk_magic == ZKERN_MAGIC)
+		load_zkern();
+
+	// is this a valid ELF?
+	if (ELFHDR->e_magic != ELF_MAGIC)
+		goto bad;
+
+	// Stop staging at the end of the last segment, rather than
+	// read the symbol and section tables behind it.
+	ph = (struct Proghdr *) ((uint8_t *) ELFHDR + ELFHDR->e_phoff);
+	eph = ph + ELFHDR->e_phnum;
+	for (end = 0; ph < eph; ph++)
+		end = MAX(end, ph->p_offset + ph->p_filesz);
+	img_nsect = MIN(img_nsect, ROUNDUP(end, SECTSIZE) / SECTSIZE);
+
+	// load each program segment (ignores ph flags)
+	ph = (struct Proghdr *) ((uint8_t *) ELFHDR + ELFHDR->e_phoff);
+	for (; ph < eph; ph++) {
+		// p_pa is the load address of this segment (as well
+		// as the physical address).  Only the first p_filesz
+		// bytes are on disk; the rest of the segment is zero.
+		if (img_need(ph->p_offset + ph->p_filesz) == 0)
+			copyseg(ph->p_pa, SCRATCH + ph->p_offset,
+				ph->p_filesz);
+		else {
+			img_idle();
+			readseg(ph->p_pa, ph->p_filesz, ph->p_offset);
+		}
+		zeroseg(ph->p_pa + ph->p_filesz, ph->p_memsz - ph->p_filesz);
+		stampseg();
+	}
+
+	// call the entry point from the ELF header
+	// note: does not return!
+	img_idle();
+	((void (*)(void)) (ELFHDR->e_entry))();
+
+bad:
+	outw(0x8A00, 0x8A00);
+	outw(0x8A00, 0x8E00);
+	while (1)
+		/* do nothing */;
+}
+
+// Load a compressed kernel image and jump to its entry point.
+// Returns only if the image is bad.
+static void
+load_zkern(void)
+{
+	struct Zseg *zs, *ezs;
+
+	if (ZKERN->zk_nseg > ZKERN_MAXSEG
+	    || ZKERN->zk_size > img_nsect * SECTSIZE)
+		return;
+	img_nsect = ROUNDUP(ZKERN->zk_size, SECTSIZE) / SECTSIZE;
+
+	// decompress each segment straight to its load address,
+	// while the following ones are still being read
+	zs = ZKERN->zk_seg;
+	ezs = zs + ZKERN->zk_nseg;
+	for (; zs < ezs; zs++) {
+		img_need(zs->zs_zoff + zs->zs_zsize);
+		if (lz4_decompress((uint8_t *) zs->zs_pa,
+				   (uint8_t *) ZKERN + zs->zs_zoff,
+				   zs->zs_zsize) != zs->zs_filesz)
+			return;
+		zeroseg(zs->zs_pa + zs->zs_filesz,
+			zs->zs_memsz - zs->zs_filesz);
+		stampseg();
+	}
+
+	// note: does not return!
+	img_idle();
+	((void (*)(void)) (ZKERN->zk_entry))();
+}
+
+// Issue the next PIO command for the image, if any is left.
+// The first page is read on its own, so that the headers can be
+// parsed while the rest of the image streams in.
+static void
+img_issue(void)
+{
+	uint32_t nsect = 0;
+
+	if (img_have < img_nsect) {
+		nsect = MIN(img_nsect - img_have, img_have ? MAXSECTS : 8);
+		readsect_issue(KERN_SECT + img_have, nsect);
+	}
+	img_busy = nsect;
+}
+
+// Make sure the first 'count' bytes of the image are in the scratch
+// area.  Returns -1 if they cannot be staged there.
+static int
+img_need(uint32_t count)
+{
+	if (count > img_nsect * SECTSIZE)
+		return -1;
+	while (img_have * SECTSIZE < count) {
+		if (img_busy == 0)
+			img_issue();
+		readsect_drain((uint8_t *) SCRATCH + img_have * SECTSIZE,
+			       img_busy);
+		img_have += img_busy;
+		// keep the drive busy while the caller works on the data
+		img_issue();
+	}
+	return 0;
+}
+
+// Wait for the command in flight, if any, so the drive is idle.
+static void
+img_idle(void)
+{
+	if (img_busy > 0) {
+		readsect_drain((uint8_t *) SCRATCH + img_have * SECTSIZE,
+			       img_busy);
+		img_have += img_busy;
+		img_busy = 0;
+	}
+}
+
+// For backwards compatibility with the earliest PCs, physical address
+// line 20 is tied low, so that addresses higher than 1MB wrap around to
+// zero by default.  Undo this through the keyboard controller.
+static void
+enable_a20(void)
+{
+	while (inb(0x64) & 0x2)		// wait for not busy
+		/* do nothing */;
+	outb(0x64, 0xD1);		// write output port
+	while (inb(0x64) & 0x2)
+		/* do nothing */;
+	outb(0x60, 0xDF);		// A20 on
+}
+
+// Stamp the TSC after loading a segment.
+static void
+stampseg(void)
+{
+	if (BI->bi_nseg < BOOTPH_MAXSEG)
+		BI->bi_tsc[BOOTPH_SEG + BI->bi_nseg++] = read_tsc();
+}
+
+// Copy 'count' bytes from physical address 'src' to 'pa'.
+static void
+copyseg(uint32_t pa, uint32_t src, uint32_t count)
+{
+	uint32_t n = count / 4;
+
+	asm volatile("cld; rep movsl"
+		     : "+D" (pa), "+S" (src), "+c" (n)
+		     : : "cc", "memory");
+	n = count % 4;
+	asm volatile("rep movsb"
+		     : "+D" (pa), "+S" (src), "+c" (n)
+		     : : "cc", "memory");
+}
+
+// Zero 'count' bytes at physical address 'pa': bytewise up to a
+// 4-byte boundary, then with rep stosl, then the last few bytes.
+static void
+zeroseg(uint32_t pa, uint32_t count)
+{
+	uint8_t *p = (uint8_t *) pa;
+	uint32_t n;
+
+	for (; count > 0 && (uint32_t) p % 4 != 0; count--)
+		*p++ = 0;
+	n = count / 4;
+	asm volatile("cld; rep stosl"
+		     : "+D" (p), "+c" (n)
+		     : "a" (0)
+		     : "cc", "memory");
+	for (count %= 4; count > 0; count--)
+		*p++ = 0;
+}
+
+// Read 'count' bytes at 'offset' from kernel into physical address 'pa'.
+// Might copy more than asked
+void
+readseg(uint32_t pa, uint32_t count, uint32_t offset)
+{
+	uint32_t end_pa, nsect;
+
+	end_pa = pa + count;
+
+	// round down to sector boundary
+	pa &= ~(SECTSIZE - 1);
+
+	// translate from bytes to sectors; the kernel starts at KERN_SECT
+	offset = (offset / SECTSIZE) + KERN_SECT;
+
+	// Read the segment with as few commands as possible, up to
+	// MAXSECTS sectors each.  We may write more to memory than
+	// asked, but it doesn't matter -- we load in increasing order.
+	while (pa < end_pa) {
+		nsect = (end_pa - pa + SECTSIZE - 1) / SECTSIZE;
+		if (nsect > MAXSECTS)
+			nsect = MAXSECTS;
+		// Since we haven't enabled paging yet and we're using
+		// an identity segment mapping (see boot.S), we can
+		// use physical addresses directly.  This won't be the
+		// case once JOS enables the MMU.
+		readsect((uint8_t*) pa, offset, nsect);
+		pa += nsect * SECTSIZE;
+		offset += nsect;
+	}
+}
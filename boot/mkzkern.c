@@ -0,0 +1,206 @@
+/*
+ * Build a compressed kernel image for the stage 2 boot loader.
+ *
+ *	mkzkern kernel kernel.lz4
+ *
+ * Each loadable segment of the ELF kernel is compressed into one raw
+ * LZ4 block; the image layout is described in boot/zkern.h.  Only the
+ * file-backed part of each segment is stored, so zero-filled memory
+ * costs nothing on disk.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <inc/elf.h>
+#include <boot/zkern.h>
+
+#define MINMATCH	4
+#define MAXOFFSET	65535
+#define LASTLITERALS	5	// the last 5 bytes are always literals
+#define MFLIMIT		12	// the last match starts 12+ bytes before the end
+#define HASHLOG		16
+
+static uint8_t *
+readfile(const char *name, size_t *sizep)
+{
+	FILE *f;
+	uint8_t *buf;
+	long n;
+
+	if ((f = fopen(name, "rb")) == NULL
+	    || fseek(f, 0, SEEK_END) < 0 || (n = ftell(f)) < 0
+	    || fseek(f, 0, SEEK_SET) < 0) {
+		perror(name);
+		exit(1);
+	}
+	if ((buf = malloc(n)) == NULL || fread(buf, 1, n, f) != (size_t) n) {
+		fprintf(stderr, "%s: short read\n", name);
+		exit(1);
+	}
+	fclose(f);
+	*sizep = n;
+	return buf;
+}
+
+static uint32_t
+read32(const uint8_t *p)
+{
+	uint32_t v;
+
+	memcpy(&v, p, 4);
+	return v;
+}
+
+static uint8_t *
+put_length(uint8_t *op, size_t len)
+{
+	for (; len >= 255; len -= 255)
+		*op++ = 255;
+	*op++ = len;
+	return op;
+}
+
+// Emit one LZ4 sequence: 'nlit' literals from 'lit', then a match of
+// 'mlen' bytes at distance 'off' (no match if mlen == 0).
+static uint8_t *
+put_sequence(uint8_t *op, const uint8_t *lit, size_t nlit,
+	     size_t off, size_t mlen)
+{
+	uint8_t *token = op++;
+
+	*token = (nlit < 15 ? nlit : 15) << 4;
+	if (nlit >= 15)
+		op = put_length(op, nlit - 15);
+	memcpy(op, lit, nlit);
+	op += nlit;
+	if (mlen == 0)
+		return op;
+
+	*op++ = off & 0xFF;
+	*op++ = off >> 8;
+	mlen -= MINMATCH;
+	*token |= mlen < 15 ? mlen : 15;
+	if (mlen >= 15)
+		op = put_length(op, mlen - 15);
+	return op;
+}
+
+// Greedy single-probe LZ4 block compressor.
+// 'dst' must have room for lz4_bound(n) bytes.
+static size_t
+lz4_compress(const uint8_t *src, size_t n, uint8_t *dst)
+{
+	static int64_t table[1 << HASHLOG];
+	size_t ip, anchor, mlen;
+	int64_t ref;
+	uint32_t seq, h;
+	uint8_t *op;
+
+	for (h = 0; h < (1 << HASHLOG); h++)
+		table[h] = -1;
+
+	op = dst;
+	ip = anchor = 0;
+	while (n > MFLIMIT && ip < n - MFLIMIT) {
+		seq = read32(src + ip);
+		h = (seq * 2654435761U) >> (32 - HASHLOG);
+		ref = table[h];
+		table[h] = ip;
+		if (ref < 0 || ip - ref > MAXOFFSET
+		    || read32(src + ref) != seq) {
+			ip++;
+			continue;
+		}
+		mlen = MINMATCH;
+		while (ip + mlen < n - LASTLITERALS
+		       && src[ref + mlen] == src[ip + mlen])
+			mlen++;
+		op = put_sequence(op, src + anchor, ip - anchor, ip - ref, mlen);
+		ip += mlen;
+		anchor = ip;
+	}
+	return put_sequence(op, src + anchor, n - anchor, 0, 0) - dst;
+}
+
+static size_t
+lz4_bound(size_t n)
+{
+	return n + n / 255 + 16;
+}
+
+int
+main(int argc, char **argv)
+{
+	struct Zkern zk;
+	struct Elf *elf;
+	struct Proghdr *ph;
+	uint8_t *kern, *out;
+	size_t ksize, osize, cap;
+	FILE *f;
+	int i;
+
+	if (argc != 3) {
+		fprintf(stderr, "Usage: mkzkern kernel image\n");
+		exit(2);
+	}
+
+	kern = readfile(argv[1], &ksize);
+	elf = (struct Elf *) kern;
+	if (ksize < sizeof(*elf) || elf->e_magic != ELF_MAGIC
+	    || elf->e_phoff + elf->e_phnum * sizeof(*ph) > ksize) {
+		fprintf(stderr, "%s: not an ELF kernel\n", argv[1]);
+		exit(1);
+	}
+
+	memset(&zk, 0, sizeof(zk));
+	zk.zk_magic = ZKERN_MAGIC;
+	zk.zk_entry = elf->e_entry;
+
+	cap = sizeof(zk);
+	ph = (struct Proghdr *) (kern + elf->e_phoff);
+	for (i = 0; i < elf->e_phnum; i++)
+		cap += lz4_bound(ph[i].p_filesz);
+	if ((out = malloc(cap)) == NULL) {
+		perror("malloc");
+		exit(1);
+	}
+
+	osize = sizeof(zk);
+	for (i = 0; i < elf->e_phnum; i++, ph++) {
+		struct Zseg *zs;
+
+		if (ph->p_type != ELF_PROG_LOAD || ph->p_memsz == 0)
+			continue;
+		if (ph->p_offset + ph->p_filesz > ksize) {
+			fprintf(stderr, "%s: segment %d out of range\n",
+				argv[1], i);
+			exit(1);
+		}
+		if (zk.zk_nseg == ZKERN_MAXSEG) {
+			fprintf(stderr, "%s: more than %d segments\n",
+				argv[1], ZKERN_MAXSEG);
+			exit(1);
+		}
+		zs = &zk.zk_seg[zk.zk_nseg++];
+		zs->zs_pa = ph->p_pa;
+		zs->zs_filesz = ph->p_filesz;
+		zs->zs_memsz = ph->p_memsz;
+		zs->zs_zoff = osize;
+		zs->zs_zsize = lz4_compress(kern + ph->p_offset,
+					    ph->p_filesz, out + osize);
+		osize += zs->zs_zsize;
+	}
+	zk.zk_size = osize;
+	memcpy(out, &zk, sizeof(zk));
+
+	if ((f = fopen(argv[2], "wb")) == NULL
+	    || fwrite(out, 1, osize, f) != osize || fclose(f) != 0) {
+		perror(argv[2]);
+		exit(1);
+	}
+	fprintf(stderr, "%s is %zu bytes (from %zu)\n", argv[2], osize, ksize);
+	return 0;
+}
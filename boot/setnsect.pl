@@ -0,0 +1,16 @@
+#!/usr/bin/perl
+
+# setnsect.pl IMAGE PAYLOAD
+# Record the size of the kernel payload in sectors in the boot block
+# of the disk image IMAGE (see KERN_NSECT_OFF in boot/boot.h).
+
+my $size = -s $ARGV[1];
+defined($size) || die "stat $ARGV[1]: $!";
+my $nsect = int(($size + 511) / 512);
+$nsect = 65535 if $nsect > 65535;
+
+open(IMG, "+<$ARGV[0]") || die "open $ARGV[0]: $!";
+binmode IMG;
+seek(IMG, 508, 0) || die "seek $ARGV[0]: $!";
+print IMG pack("v", $nsect);
+close IMG;
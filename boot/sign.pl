@@ -7,12 +7,13 @@ my $buf;
 read(BB, $buf, 1000);
 $n = length($buf);
 
-if($n > 510){
-	print STDERR "boot block too large: $n bytes (max 510)\n";
+# Bytes 508-509 hold the kernel size in sectors (see boot/setnsect.pl).
+if($n > 508){
+	print STDERR "boot block too large: $n bytes (max 508)\n";
 	exit 1;
 }
 
-print STDERR "boot block is $n bytes (max 510)\n";
+print STDERR "boot block is $n bytes (max 508)\n";
 
 $buf .= "\0" x (510-$n);
 $buf .= "\x55\xAA";
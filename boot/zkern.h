@@ -0,0 +1,32 @@
+#ifndef JOS_BOOT_ZKERN_H
+#define JOS_BOOT_ZKERN_H
+
+/*
+ * Compressed kernel image, produced from the ELF kernel by
+ * boot/mkzkern.c and unpacked by the stage 2 boot loader.
+ *
+ * The image starts with a struct Zkern.  Each loadable ELF segment's
+ * file contents are stored as one raw LZ4 block (no frame header) at
+ * zs_zoff bytes from the start of the image.
+ */
+
+#define ZKERN_MAGIC	0x4E524B5AU	/* "ZKRN" in little endian */
+#define ZKERN_MAXSEG	8
+
+struct Zseg {
+	uint32_t zs_pa;		// physical load address
+	uint32_t zs_filesz;	// bytes of segment data stored in the block
+	uint32_t zs_memsz;	// bytes of the segment in memory
+	uint32_t zs_zoff;	// offset of the LZ4 block in the image
+	uint32_t zs_zsize;	// size of the LZ4 block
+};
+
+struct Zkern {
+	uint32_t zk_magic;	// must equal ZKERN_MAGIC
+	uint32_t zk_size;	// size of the whole image in bytes
+	uint32_t zk_entry;	// kernel entry point (physical)
+	uint32_t zk_nseg;
+	struct Zseg zk_seg[ZKERN_MAXSEG];
+};
+
+#endif /* !JOS_BOOT_ZKERN_H */
@@ -0,0 +1,12 @@
+// Included ahead of the lib/ sources that 'make host-bench' compiles
+// natively (gcc -include): the host's types stand in for inc/types.h,
+// whose 32-bit size_t and pointers clash with a 64-bit host's.
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#define JOS_INC_TYPES_H
+
+typedef uint32_t physaddr_t;
+typedef uint32_t ppn_t;
@@ -0,0 +1,536 @@
+/*
+ * Host tests and benchmarks for lib/string.c and lib/printfmt.c.
+ *
+ *	make host-bench
+ *
+ * The lib/ code is compiled natively with its symbols renamed jos_*
+ * (see host/Makefrag), so it can run side by side with the C library.
+ * First each routine is checked against the C library on random
+ * inputs, once for each set of CPU features string_select can be
+ * given and the host has; buffers end at an unmapped page, so a read
+ * past the end faults.  Then each is timed across sizes and
+ * alignments, in ns per call and GB/s.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <cpuid.h>
+
+// lib/string.c and lib/printfmt.c, as renamed by objcopy.  The JOS
+// headers can't be included next to the C library's.
+int	jos_strlen(const char *s);
+int	jos_strnlen(const char *s, size_t size);
+int	jos_strcmp(const char *s1, const char *s2);
+char *	jos_strchr(const char *s, char c);
+char *	jos_strfind(const char *s, char c);
+void *	jos_memset(void *dst, int c, size_t len);
+void *	jos_memcpy(void *dst, const void *src, size_t len);
+void *	jos_memmove(void *dst, const void *src, size_t len);
+int	jos_memcmp(const void *s1, const void *s2, size_t len);
+void *	jos_memfind(const void *s, int c, size_t len);
+void	jos_string_select(int features);
+int	jos_snprintf(char *str, int size, const char *fmt, ...);
+
+// From inc/string.h
+#define STR_SSE2	0x1
+#define STR_ERMS	0x2
+#define STR_FSRM	0x4
+
+#define NFUZZ		200000	// random cases per routine and variant
+
+/***** Variants *****/
+
+// The feature sets to try: each adds one that the host has.
+struct Variant {
+	const char *name;
+	int features;
+};
+
+static struct Variant variants[4] = { { "rep", 0 } };
+static int nvariant = 1;
+
+static void
+find_variants(void)
+{
+	unsigned a, b, c, d;
+	int f = 0;
+
+	if (!__builtin_cpu_supports("sse2"))
+		return;
+	f |= STR_SSE2;
+	variants[nvariant++] = (struct Variant) { "sse2", f };
+	if (!__get_cpuid_count(7, 0, &a, &b, &c, &d))
+		return;
+	if (b & (1 << 9)) {
+		f |= STR_ERMS;
+		variants[nvariant++] = (struct Variant) { "+erms", f };
+	}
+	if (d & (1 << 4)) {
+		f |= STR_FSRM;
+		variants[nvariant++] = (struct Variant) { "+fsrm", f };
+	}
+}
+
+/***** Checking *****/
+
+static unsigned long nfail;
+
+#define CHECK(cond, ...) do {						\
+	if (!(cond) && nfail++ < 20) {					\
+		printf("FAIL %s:%d: ", __FILE__, __LINE__);		\
+		printf(__VA_ARGS__);					\
+		printf("\n");						\
+	}								\
+} while (0)
+
+// Return 'size' bytes that end where an inaccessible page begins.
+static char *
+guarded_alloc(size_t size)
+{
+	size_t pg = sysconf(_SC_PAGESIZE);
+	size_t len = (size + pg - 1) / pg * pg;
+	char *p;
+
+	p = mmap(NULL, len + pg, PROT_READ | PROT_WRITE,
+		 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (p == MAP_FAILED || mprotect(p + len, pg, PROT_NONE) < 0) {
+		perror("mmap");
+		exit(1);
+	}
+	return p + len - size;
+}
+
+static int
+sign(int x)
+{
+	return (x > 0) - (x < 0);
+}
+
+// Bytes that exercise the word tricks: zero, high bits, and few
+// distinct values so that searches and compares hit.
+static char
+rand_byte(void)
+{
+	static const char bytes[] = { 'a', 'b', '\x80', '\xff', '\x01', 'z' };
+
+	return bytes[random() % sizeof(bytes)];
+}
+
+#define SBUF		512
+
+static void
+fuzz_strings(const char *variant)
+{
+	static char *sbuf, *tbuf;
+	char *s, *t, *want;
+	int i, j, len, tlen;
+	size_t n;
+	char c;
+
+	if (!sbuf) {
+		sbuf = guarded_alloc(SBUF);
+		tbuf = guarded_alloc(SBUF);
+	}
+	for (i = 0; i < NFUZZ; i++) {
+		// A string ending at the guard page, or short of it.
+		len = random() % (SBUF / 2);
+		s = sbuf + SBUF - len - 1 - (random() % 2 ? 0 : random() % 8);
+		for (j = 0; j < len; j++)
+			s[j] = rand_byte();
+		s[len] = '\0';
+
+		CHECK(jos_strlen(s) == len, "%s strlen len %d", variant, len);
+		n = random() % (len + 10);
+		CHECK(jos_strnlen(s, n) == (int) strnlen(s, n),
+		      "%s strnlen len %d n %zu", variant, len, n);
+
+		c = random() % 8 ? rand_byte() : '\0';
+		want = c ? strchr(s, c) : NULL;
+		CHECK(jos_strchr(s, c) == want, "%s strchr len %d c %02x",
+		      variant, len, (unsigned char) c);
+		if (!(want = strchr(s, c)))
+			want = s + len;
+		CHECK(jos_strfind(s, c) == want, "%s strfind len %d c %02x",
+		      variant, len, (unsigned char) c);
+
+		// A prefix of s, maybe changed, at another alignment.
+		tlen = random() % (len + 4);
+		t = tbuf + SBUF - tlen - 1 - random() % 8;
+		for (j = 0; j < tlen; j++)
+			t[j] = j < len ? s[j] : rand_byte();
+		if (tlen && random() % 2)
+			t[random() % tlen] = rand_byte();
+		t[tlen] = '\0';
+		CHECK(sign(jos_strcmp(s, t)) == sign(strcmp(s, t))
+		      && sign(jos_strcmp(t, s)) == sign(strcmp(t, s)),
+		      "%s strcmp len %d tlen %d", variant, len, tlen);
+	}
+}
+
+#define MBUF		12288
+
+static void
+fuzz_mem(const char *variant)
+{
+	static char *a, *b, *ref;
+	int i, j, k, want, c;
+	size_t n, so, dof;
+	char *p, *f;
+
+	if (!a) {
+		a = guarded_alloc(MBUF);
+		b = guarded_alloc(MBUF);
+		ref = malloc(MBUF);
+	}
+	for (i = 0; i < NFUZZ; i++) {
+		for (j = 0; j < MBUF; j++)
+			a[j] = b[j] = rand_byte();
+		// Mostly small sizes, some past the bulk thresholds.
+		switch (random() % 3) {
+		case 0:
+			n = random() % 80;
+			break;
+		case 1:
+			n = random() % 1200;
+			break;
+		default:
+			n = random() % (MBUF / 2);
+		}
+		so = random() % (MBUF - n + 1);
+		dof = random() % (MBUF - n + 1);
+		memcpy(ref, a, MBUF);
+
+		switch (k = random() % 3) {
+		case 0:
+			c = random();
+			memset(ref + dof, c, n);
+			CHECK(jos_memset(a + dof, c, n) == a + dof, "memset ret");
+			break;
+		case 1:
+			memmove(ref + dof, ref + so, n);
+			CHECK(jos_memmove(a + dof, a + so, n) == a + dof,
+			      "memmove ret");
+			break;
+		default:
+			memcpy(ref + dof, b + so, n);
+			CHECK(jos_memcpy(a + dof, b + so, n) == a + dof,
+			      "memcpy ret");
+		}
+		CHECK(memcmp(a, ref, MBUF) == 0, "%s %s n %zu src %zu dst %zu",
+		      variant, k == 0 ? "memset" : k == 1 ? "memmove" : "memcpy",
+		      n, so, dof);
+
+		// Compare and search regions that end at the guard page.
+		p = a + MBUF - n;
+		f = b + MBUF - n;
+		memcpy(f, p, n);
+		if (n && random() % 2)
+			f[random() % n] = rand_byte();
+		want = 0;
+		for (j = 0; j < (int) n; j++)
+			if (p[j] != f[j]) {
+				want = (int) (unsigned char) p[j]
+					- (int) (unsigned char) f[j];
+				break;
+			}
+		CHECK(jos_memcmp(p, f, n) == want, "%s memcmp n %zu", variant, n);
+
+		c = random() % 8 ? rand_byte() : random();
+		f = memchr(p, c, n);
+		CHECK(jos_memfind(p, c, n) == (f ? f : p + n),
+		      "%s memfind n %zu c %d", variant, n, c);
+	}
+}
+
+// One random conversion that printfmt handles the way C does: it
+// has no %o or number precision, pads with its '-' flag for numbers,
+// counts a minus sign outside the field width, and reads a precision
+// of 0 as the '0' flag.
+static void
+fuzz_printf(void)
+{
+	static const char *strs[] = { "", "x", "hello", "a longer string" };
+	char fmt[64], spec[32], want[128], got[128];
+	int i, w, rw, rg, size;
+	unsigned long long v;
+
+	for (i = 0; i < NFUZZ; i++) {
+		w = random() % 3 ? -1 : (int) (random() % 20);
+		v = ((unsigned long long) random() << 32) ^ random();
+		size = 1 + random() % 80;
+		switch (random() % 9) {
+		case 0:
+			v = (int) v >> (random() % 32);
+			if ((int) v < 0)
+				w = -1;
+			snprintf(spec, sizeof(spec), w < 0 ? "%%d" : "%%%s%dd",
+				 random() % 2 ? "0" : "", w);
+			snprintf(fmt, sizeof(fmt), "<%s>", spec);
+			rw = snprintf(want, size, fmt, (int) v);
+			rg = jos_snprintf(got, size, fmt, (int) v);
+			break;
+		case 1:
+			v >>= random() % 64;
+			snprintf(fmt, sizeof(fmt), w < 0 ? "%%llu" : "%%0%dllu", w);
+			rw = snprintf(want, size, fmt, v);
+			rg = jos_snprintf(got, size, fmt, v);
+			break;
+		case 2:
+			v = (unsigned) v >> (random() % 32);
+			snprintf(fmt, sizeof(fmt), w < 0 ? "x=%%x" : "x=%%0%dx", w);
+			rw = snprintf(want, size, fmt, (unsigned) v);
+			rg = jos_snprintf(got, size, fmt, (unsigned) v);
+			break;
+		case 3:
+			v >>= random() % 64;
+			snprintf(fmt, sizeof(fmt), w < 0 ? "%%lx" : "%%%dlx", w);
+			rw = snprintf(want, size, fmt, (unsigned long) v);
+			rg = jos_snprintf(got, size, fmt, (unsigned long) v);
+			break;
+		case 4:
+			v = (long long) v >> (random() % 64);
+			snprintf(fmt, sizeof(fmt), "[%%lld]");
+			rw = snprintf(want, size, fmt, (long long) v);
+			rg = jos_snprintf(got, size, fmt, (long long) v);
+			break;
+		case 5:
+		case 6: {
+			const char *s = strs[random() % 4];
+			int prec = random() % 2 ? -1 : (int) (1 + random() % 8);
+
+			snprintf(spec, sizeof(spec), "%%%s", random() % 2 ? "-" : "");
+			if (w >= 0)
+				snprintf(spec + strlen(spec), 8, "%d", w);
+			if (prec >= 0)
+				snprintf(spec + strlen(spec), 8, ".%d", prec);
+			snprintf(fmt, sizeof(fmt), "%ss|", spec);
+			rw = snprintf(want, size, fmt, s);
+			rg = jos_snprintf(got, size, fmt, s);
+			break;
+		}
+		case 7:
+			snprintf(fmt, sizeof(fmt), "%%c%%c 100%%%%");
+			rw = snprintf(want, size, fmt, 'A' + (int) (v % 26), '~');
+			rg = jos_snprintf(got, size, fmt, 'A' + (int) (v % 26), '~');
+			break;
+		default:
+			snprintf(fmt, sizeof(fmt), "%%p");
+			v |= 1;
+			rw = snprintf(want, size, fmt, (void *) (uintptr_t) v);
+			rg = jos_snprintf(got, size, fmt, (void *) (uintptr_t) v);
+		}
+		CHECK(rw == rg && strcmp(want, got) == 0,
+		      "snprintf(%d, \"%s\"): want %d \"%s\", got %d \"%s\"",
+		      size, fmt, rw, want, rg, got);
+	}
+}
+
+/***** Benchmarks *****/
+
+enum { B_MEMCPY, B_MEMMOVE, B_MEMSET, B_MEMCMP, B_MEMFIND, B_STRLEN, NBENCH };
+
+static const char *bench_names[NBENCH] = {
+	"memcpy", "memmove", "memset", "memcmp", "memfind", "strlen",
+};
+
+// Called through volatile pointers, so the compiler can neither
+// inline the C library's versions nor hoist pure calls out of loops.
+static void *(*volatile c_memcpy)(void *, const void *, size_t) = memcpy;
+static void *(*volatile c_memmove)(void *, const void *, size_t) = memmove;
+static void *(*volatile c_memset)(void *, int, size_t) = memset;
+static int (*volatile c_memcmp)(const void *, const void *, size_t) = memcmp;
+static void *(*volatile c_memchr)(const void *, int, size_t) = memchr;
+static size_t (*volatile c_strlen)(const char *) = strlen;
+static void *(*volatile j_memcpy)(void *, const void *, size_t) = jos_memcpy;
+static void *(*volatile j_memmove)(void *, const void *, size_t) = jos_memmove;
+static void *(*volatile j_memset)(void *, int, size_t) = jos_memset;
+static int (*volatile j_memcmp)(const void *, const void *, size_t) = jos_memcmp;
+static void *(*volatile j_memfind)(const void *, int, size_t) = jos_memfind;
+static int (*volatile j_strlen)(const char *) = jos_strlen;
+
+static volatile uintptr_t sink;
+
+static double
+now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void
+bench_loop(int b, bool jos, char *d, char *s, size_t n, long iters)
+{
+	long i;
+
+	for (i = 0; i < iters; i++)
+		switch (b) {
+		case B_MEMCPY:
+			sink = (uintptr_t) (jos ? j_memcpy : c_memcpy)(d, s, n);
+			break;
+		case B_MEMMOVE:
+			sink = (uintptr_t) (jos ? j_memmove : c_memmove)(d, s, n);
+			break;
+		case B_MEMSET:
+			sink = (uintptr_t) (jos ? j_memset : c_memset)(d, 0, n);
+			break;
+		case B_MEMCMP:
+			sink = (jos ? j_memcmp : c_memcmp)(d, s, n);
+			break;
+		case B_MEMFIND:
+			// searches the whole buffer: jos_memfind returns
+			// the end, memchr NULL
+			sink = (uintptr_t) (jos ? j_memfind : c_memchr)(s, 'b', n);
+			break;
+		default:
+			sink = jos ? (size_t) j_strlen(s) : c_strlen(s);
+		}
+}
+
+// Return the best of a few timings of 'b' on n bytes, in ns per call.
+static double
+bench_one(int b, bool jos, char *d, char *s, size_t n)
+{
+	double t, best = 1e30;
+	long iters;
+	int rep;
+
+	// Enough calls for a millisecond or so.
+	for (iters = 1; ; iters *= 2) {
+		t = now_ns();
+		bench_loop(b, jos, d, s, n, iters);
+		if (now_ns() - t > 1e6)
+			break;
+	}
+	for (rep = 0; rep < 3; rep++) {
+		t = now_ns();
+		bench_loop(b, jos, d, s, n, iters);
+		t = (now_ns() - t) / iters;
+		if (t < best)
+			best = t;
+	}
+	return best;
+}
+
+#define BBUF		(2 << 20)
+
+static void
+bench_all(void)
+{
+	static const size_t sizes[] = { 16, 64, 256, 1024, 4096, 65536, 1 << 20 };
+	static const int offs[][2] = { { 0, 0 }, { 1, 3 } };	// (dst, src)
+	char *dbuf, *sbuf, *d, *s;
+	double t;
+	size_t n;
+	int b, i, j, v;
+
+	dbuf = aligned_alloc(4096, BBUF);
+	sbuf = aligned_alloc(4096, BBUF);
+	memset(dbuf, 'a', BBUF);
+	memset(sbuf, 'a', BBUF);
+
+	printf("\nns per call and GB/s; jos_ variants use the features listed\n");
+	for (b = 0; b < NBENCH; b++) {
+		printf("\n%-8s %7s %6s %17s", bench_names[b], "size", "align", "libc");
+		for (v = 0; v < nvariant; v++)
+			printf(" %17s", variants[v].name);
+		printf("\n");
+		for (i = 0; i < (int) (sizeof(sizes) / sizeof(sizes[0])); i++)
+			for (j = 0; j < 2; j++) {
+				n = sizes[i];
+				d = dbuf + offs[j][0];
+				s = sbuf + offs[j][1];
+				if (b == B_MEMMOVE)	// overlapping, backward
+					d = s + 64 + offs[j][0];
+				if (b == B_MEMCMP)
+					memcpy(d, s, n);
+				if (b == B_STRLEN)
+					s[n] = '\0';
+				printf("%8s %7zu  (%d,%d)", "", n, offs[j][0], offs[j][1]);
+				t = bench_one(b, false, d, s, n);
+				printf(" %7.1fns %5.1fGB/s", t, n / t);
+				for (v = 0; v < nvariant; v++) {
+					jos_string_select(variants[v].features);
+					t = bench_one(b, true, d, s, n);
+					printf(" %7.1fns %5.1fGB/s", t, n / t);
+				}
+				printf("\n");
+				if (b == B_STRLEN)
+					s[n] = 'a';
+				memset(dbuf, 'a', BBUF);
+				memset(sbuf, 'a', BBUF);
+			}
+	}
+	free(dbuf);
+	free(sbuf);
+}
+
+static void
+bench_printf(void)
+{
+	static const char *fmts[] = {
+		"%d", "%08x", "%llu", "%s", "%-20s|%5d|%llx",
+	};
+	char buf[128];
+	double t, tj;
+	long i, iters = 200000;
+	int f;
+
+	printf("\n%-24s %10s %10s\n", "snprintf", "libc", "jos");
+	for (f = 0; f < (int) (sizeof(fmts) / sizeof(fmts[0])); f++) {
+#define RUN(fn) do {							\
+	t = now_ns();							\
+	for (i = 0; i < iters; i++)					\
+		switch (f) {						\
+		case 0: fn(buf, sizeof(buf), fmts[f], (int) i); break;	\
+		case 1: fn(buf, sizeof(buf), fmts[f], (unsigned) i); break; \
+		case 2: fn(buf, sizeof(buf), fmts[f], 12345678901234ULL * i); break; \
+		case 3: fn(buf, sizeof(buf), fmts[f], "a moderately long string"); break; \
+		default: fn(buf, sizeof(buf), fmts[f], "name", (int) i, 0xdeadbeefULL * i); \
+		}							\
+	t = (now_ns() - t) / iters;					\
+} while (0)
+		RUN(snprintf);
+		tj = t;
+		RUN(jos_snprintf);
+#undef RUN
+		printf("%-24s %8.1fns %8.1fns\n", fmts[f], tj, t);
+	}
+}
+
+int
+main(void)
+{
+	unsigned long nfail0;
+	int v;
+
+	srandom(1);
+	find_variants();
+	for (v = 0; v < nvariant; v++) {
+		nfail0 = nfail;
+		jos_string_select(variants[v].features);
+		fuzz_strings(variants[v].name);
+		fuzz_mem(variants[v].name);
+		printf("string and memory routines, %s: %s\n", variants[v].name,
+		       nfail > nfail0 ? "FAILED" : "OK");
+	}
+	nfail0 = nfail;
+	fuzz_printf();
+	printf("snprintf: %s\n", nfail > nfail0 ? "FAILED" : "OK");
+	if (nfail) {
+		printf("libbench: %lu checks failed\n", nfail);
+		return 1;
+	}
+
+	bench_all();
+	bench_printf();
+	return 0;
+}
@@ -0,0 +1,411 @@
+/*
+ * Host unit tests for inc/atomic.h and inc/lockfree.h.
+ *
+ *	make host-test
+ *
+ * Each structure is hammered by several threads, and the test checks
+ * that every item comes out exactly once, and in order where the
+ * structure promises order.  The threads mostly interleave through
+ * preemption on a small machine, so iteration counts are modest.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <pthread.h>
+#include <sched.h>
+
+// Use the host's types: inc/types.h's 32-bit typedefs clash with a
+// 64-bit libc's.
+#define JOS_INC_TYPES_H
+typedef uint32_t physaddr_t;
+
+#include <inc/atomic.h>
+#include <inc/lockfree.h>
+
+#define NTHREAD		4
+#define NITER		200000
+
+static void
+run_threads(int n, void *(*fn)(void *))
+{
+	pthread_t t[NTHREAD * 2];
+	intptr_t i;
+
+	assert(n <= NTHREAD * 2);
+	for (i = 0; i < n; i++)
+		if (pthread_create(&t[i], NULL, fn, (void *) i) != 0) {
+			perror("pthread_create");
+			exit(1);
+		}
+	for (i = 0; i < n; i++)
+		pthread_join(t[i], NULL);
+}
+
+/***** Atomic operations *****/
+
+static void
+test_atomic_ops(void)
+{
+	uint8_t b = 0xF0;
+	uint16_t w = 1000;
+	uint32_t l = 5;
+	uint64_t q = 0x100000000ULL;
+	uintptr_t pair[2] __attribute__((aligned(2 * sizeof(uintptr_t)))) = { 1, 2 };
+	int x, y, *p = &x;
+
+	assert(atomic_xchg(&l, 7) == 5 && l == 7);
+	assert(atomic_xchg(&p, &y) == &x && p == &y);
+
+	assert(atomic_cmpxchg(&l, 7, 9) == 7 && l == 9);
+	assert(atomic_cmpxchg(&l, 7, 11) == 9 && l == 9);
+	assert(atomic_cmpxchg(&p, &y, NULL) == &y && p == NULL);
+	assert(atomic_cmpxchg(&b, 0xF0, 0x0F) == 0xF0 && b == 0x0F);
+
+	assert(atomic_fetch_add(&w, 24) == 1000 && w == 1024);
+	assert(atomic_fetch_add(&l, -10) == 9 && l == (uint32_t) -1);
+	atomic_add(&w, 1);
+	assert(w == 1025);
+
+	l = 0x0F;
+	atomic_or(&l, 0xF0);
+	assert(l == 0xFF);
+	atomic_and(&l, 0x3C);
+	assert(l == 0x3C);
+	assert(atomic_fetch_or(&l, 0x03) == 0x3C && l == 0x3F);
+	assert(atomic_fetch_and(&l, 0xF0) == 0x3F && l == 0x30);
+	assert(atomic_fetch_or(&b, 0xF0) == 0x0F && b == 0xFF);
+
+	assert(atomic_cmpxchg64(&q, 0x100000000ULL, 0x2FFFFFFFFULL) == 0x100000000ULL);
+	assert(q == 0x2FFFFFFFFULL);
+	assert(atomic_cmpxchg64(&q, 1, 2) == 0x2FFFFFFFFULL && q == 0x2FFFFFFFFULL);
+	assert(atomic_read64(&q) == 0x2FFFFFFFFULL);
+
+	assert(atomic_cmpxchg2(pair, 1, 2, 3, 4) && pair[0] == 3 && pair[1] == 4);
+	assert(!atomic_cmpxchg2(pair, 3, 5, 6, 7) && pair[0] == 3 && pair[1] == 4);
+
+	printf("atomic ops: OK\n");
+}
+
+static volatile uint32_t counter32;
+static volatile uint64_t counter64;
+static volatile uint32_t orbits;
+
+static void *
+atomic_thread(void *arg)
+{
+	intptr_t id = (intptr_t) arg;
+	uint64_t old;
+	int i;
+
+	for (i = 0; i < NITER; i++) {
+		atomic_fetch_add(&counter32, 1);
+		do {
+			old = atomic_read64(&counter64);
+		} while (atomic_cmpxchg64(&counter64, old, old + 0x100000001ULL) != old);
+	}
+	atomic_fetch_or(&orbits, 1 << id);
+	return NULL;
+}
+
+static void
+test_atomic_threads(void)
+{
+	run_threads(NTHREAD, atomic_thread);
+	assert(counter32 == NTHREAD * NITER);
+	assert(counter64 == (uint64_t) NTHREAD * NITER * 0x100000001ULL);
+	assert(orbits == (1 << NTHREAD) - 1);
+	printf("atomic ops, %d threads: OK\n", NTHREAD);
+}
+
+/***** Treiber stack *****/
+
+#define NNODE		64
+
+struct tnode {
+	struct lf_node link;
+	volatile uint32_t popped;	// set while a thread owns it
+};
+
+static struct tnode tnodes[NNODE];
+static struct lf_stack tstack;
+
+static void *
+stack_thread(void *arg)
+{
+	struct lf_node *n[4];
+	struct tnode *t;
+	int i, j, k;
+
+	for (i = 0; i < NITER; i++) {
+		// pop a few, check nobody else has them, push them back
+		k = i % 4 + 1;
+		for (j = 0; j < k; j++) {
+			if ((n[j] = lf_stack_pop(&tstack)) == NULL)
+				break;
+			t = (struct tnode *) n[j];
+			assert(atomic_xchg(&t->popped, 1) == 0);
+		}
+		while (j-- > 0) {
+			t = (struct tnode *) n[j];
+			assert(atomic_xchg(&t->popped, 0) == 1);
+			lf_stack_push(&tstack, n[j]);
+		}
+	}
+	return NULL;
+}
+
+static void
+test_lf_stack(void)
+{
+	bool seen[NNODE] = { 0 };
+	struct lf_node *n;
+	int i;
+
+	lf_stack_init(&tstack);
+	assert(lf_stack_pop(&tstack) == NULL);
+	for (i = 0; i < NNODE; i++)
+		lf_stack_push(&tstack, &tnodes[i].link);
+	// LIFO
+	assert(lf_stack_pop(&tstack) == &tnodes[NNODE - 1].link);
+	lf_stack_push(&tstack, &tnodes[NNODE - 1].link);
+
+	run_threads(NTHREAD, stack_thread);
+
+	for (i = 0; i < NNODE; i++) {
+		assert((n = lf_stack_pop(&tstack)) != NULL);
+		assert(!seen[(struct tnode *) n - tnodes]);
+		seen[(struct tnode *) n - tnodes] = true;
+	}
+	assert(lf_stack_pop(&tstack) == NULL);
+	printf("lf_stack, %d threads: OK\n", NTHREAD);
+}
+
+/***** MPMC ring *****/
+
+#define RINGSIZE	256
+
+static struct mpmc_cell mcells[RINGSIZE];
+static struct mpmc_ring mring;
+static volatile uint32_t mconsumed;
+static uint64_t msum[NTHREAD];
+
+// Items are (producer << 24 | sequence) + 1, so never NULL.
+static void *
+mpmc_producer(void *arg)
+{
+	intptr_t id = (intptr_t) arg;
+	uintptr_t i;
+
+	for (i = 0; i < NITER; i++)
+		while (!mpmc_ring_enqueue(&mring, (void *) ((id << 24 | i) + 1)))
+			sched_yield();
+	return NULL;
+}
+
+static void *
+mpmc_consumer(void *arg)
+{
+	intptr_t id = (intptr_t) arg - NTHREAD;
+	uintptr_t last[NTHREAD], v, prod, seq;
+	void *data;
+	int i;
+
+	for (i = 0; i < NTHREAD; i++)
+		last[i] = (uintptr_t) -1;
+	while (mconsumed < NTHREAD * NITER) {
+		if (!mpmc_ring_dequeue(&mring, &data)) {
+			sched_yield();
+			continue;
+		}
+		atomic_fetch_add(&mconsumed, 1);
+		v = (uintptr_t) data - 1;
+		prod = v >> 24;
+		seq = v & 0xFFFFFF;
+		assert(prod < NTHREAD);
+		// one consumer sees each producer's items in order
+		assert(last[prod] == (uintptr_t) -1 || seq > last[prod]);
+		last[prod] = seq;
+		msum[id] += v;
+	}
+	return NULL;
+}
+
+static void *
+mpmc_thread(void *arg)
+{
+	if ((intptr_t) arg < NTHREAD)
+		return mpmc_producer(arg);
+	return mpmc_consumer(arg);
+}
+
+static void
+test_mpmc_ring(void)
+{
+	uint64_t sum, expect;
+	void *data;
+	intptr_t p;
+	int i;
+
+	mpmc_ring_init(&mring, mcells, RINGSIZE);
+	assert(!mpmc_ring_dequeue(&mring, &data));
+	for (i = 0; i < RINGSIZE; i++)
+		assert(mpmc_ring_enqueue(&mring, (void *) (intptr_t) (i + 1)));
+	assert(!mpmc_ring_enqueue(&mring, (void *) 1));
+	for (i = 0; i < RINGSIZE; i++)
+		assert(mpmc_ring_dequeue(&mring, &data) && data == (void *) (intptr_t) (i + 1));
+	assert(!mpmc_ring_dequeue(&mring, &data));
+
+	run_threads(2 * NTHREAD, mpmc_thread);
+
+	expect = 0;
+	for (p = 0; p < NTHREAD; p++)
+		expect += (uint64_t) NITER * (p << 24) + (uint64_t) NITER * (NITER - 1) / 2;
+	sum = 0;
+	for (i = 0; i < NTHREAD; i++)
+		sum += msum[i];
+	assert(sum == expect);
+	assert(!mpmc_ring_dequeue(&mring, &data));
+	printf("mpmc_ring, %d producers, %d consumers: OK\n", NTHREAD, NTHREAD);
+}
+
+/***** SPSC ring *****/
+
+static void *sslots[RINGSIZE];
+static struct spsc_ring sring;
+
+static void *
+spsc_thread(void *arg)
+{
+	uintptr_t i;
+	void *data;
+
+	if ((intptr_t) arg == 0) {
+		for (i = 1; i <= NITER; i++)
+			while (!spsc_ring_enqueue(&sring, (void *) i))
+				sched_yield();
+	} else {
+		for (i = 1; i <= NITER; i++) {
+			while (!spsc_ring_dequeue(&sring, &data))
+				sched_yield();
+			assert(data == (void *) i);
+		}
+	}
+	return NULL;
+}
+
+static void
+test_spsc_ring(void)
+{
+	void *data;
+	int i;
+
+	spsc_ring_init(&sring, sslots, RINGSIZE);
+	assert(!spsc_ring_dequeue(&sring, &data));
+	for (i = 0; i < RINGSIZE; i++)
+		assert(spsc_ring_enqueue(&sring, (void *) (intptr_t) (i + 1)));
+	assert(!spsc_ring_enqueue(&sring, (void *) 1));
+	for (i = 0; i < RINGSIZE; i++)
+		assert(spsc_ring_dequeue(&sring, &data) && data == (void *) (intptr_t) (i + 1));
+	assert(!spsc_ring_dequeue(&sring, &data));
+
+	run_threads(2, spsc_thread);
+	assert(!spsc_ring_dequeue(&sring, &data));
+	printf("spsc_ring, 1 producer, 1 consumer: OK\n");
+}
+
+/***** Work-stealing deque *****/
+
+#define NWSITEM		(NITER * 2)
+
+static void *wslots[RINGSIZE];
+static struct ws_deque wsdeque;
+static volatile uint8_t wstaken[NWSITEM + 1];
+static volatile uint32_t wsntaken;
+static uint32_t wsnstolen[NTHREAD];
+
+static void
+ws_take(void *data)
+{
+	uintptr_t i = (uintptr_t) data;
+
+	assert(i >= 1 && i <= NWSITEM);
+	assert(atomic_xchg(&wstaken[i], 1) == 0);
+	atomic_fetch_add(&wsntaken, 1);
+}
+
+// Thread 0 owns the deque: it pushes every item and pops some back,
+// like a fork/join worker; the others only steal.
+static void *
+ws_thread(void *arg)
+{
+	intptr_t id = (intptr_t) arg;
+	uintptr_t i;
+	void *data;
+
+	if (id == 0) {
+		for (i = 1; i <= NWSITEM; i++) {
+			while (!ws_deque_push(&wsdeque, (void *) i))
+				if ((data = ws_deque_pop(&wsdeque)))
+					ws_take(data);
+			if (i % 3 == 0 && (data = ws_deque_pop(&wsdeque)))
+				ws_take(data);
+		}
+		while ((data = ws_deque_pop(&wsdeque)))
+			ws_take(data);
+	} else {
+		while (wsntaken < NWSITEM) {
+			if ((data = ws_deque_steal(&wsdeque))) {
+				ws_take(data);
+				wsnstolen[id]++;
+			} else
+				sched_yield();
+		}
+	}
+	return NULL;
+}
+
+static void
+test_ws_deque(void)
+{
+	uint32_t nstolen;
+	void *data;
+	int i;
+
+	ws_deque_init(&wsdeque, wslots, RINGSIZE);
+	assert(!ws_deque_pop(&wsdeque) && !ws_deque_steal(&wsdeque));
+	for (i = 1; i <= RINGSIZE; i++)
+		assert(ws_deque_push(&wsdeque, (void *) (intptr_t) i));
+	assert(!ws_deque_push(&wsdeque, (void *) 1));
+	// the owner pops the newest, a thief steals the oldest
+	assert(ws_deque_pop(&wsdeque) == (void *) RINGSIZE);
+	assert(ws_deque_steal(&wsdeque) == (void *) 1);
+	while ((data = ws_deque_pop(&wsdeque)))
+		/* do nothing */;
+	assert(!ws_deque_steal(&wsdeque));
+
+	ws_deque_init(&wsdeque, wslots, RINGSIZE);
+	run_threads(NTHREAD, ws_thread);
+	assert(wsntaken == NWSITEM);
+	nstolen = 0;
+	for (i = 1; i < NTHREAD; i++)
+		nstolen += wsnstolen[i];
+	printf("ws_deque, 1 owner, %d thieves: OK (%u of %u stolen)\n",
+	       NTHREAD - 1, nstolen, NWSITEM);
+}
+
+int
+main(void)
+{
+	test_atomic_ops();
+	test_atomic_threads();
+	test_lf_stack();
+	test_mpmc_ring();
+	test_spsc_ring();
+	test_ws_deque();
+	printf("lockfree_test: all tests passed\n");
+	return 0;
+}
@@ -0,0 +1,69 @@
+#ifndef JOS_INC_ALTERNATIVE_H
+#define JOS_INC_ALTERNATIVE_H
+
+// Alternative instructions: code with a default instruction sequence
+// and a replacement for CPUs with some CPUID feature.  Each use adds
+// an entry to the .altinstructions section, and apply_alternatives()
+// (kern/alternative.c) copies the replacement over the default once
+// at boot, on CPUs with the feature, padding with NOPs.  So the test
+// costs nothing afterwards: there is no flag to load, and no indirect
+// call.
+//
+// 'feat' is a FEAT_ constant from inc/x86.h.  The replacement may be
+// shorter than the default but must not refer to anything by a
+// PC-relative address, like a call or jmp: it will run somewhere
+// else.  Until apply_alternatives runs, and outside the kernel, the
+// default runs.
+
+#include <inc/types.h>
+
+struct Alternative {
+	uint32_t a_instr;		// Address of the default code
+	uint32_t a_repl;		// Address of the replacement
+	uint16_t a_feat;		// FEAT_ it needs
+	uint8_t a_instrlen;		// Length of the default, with padding
+	uint8_t a_repllen;		// Length of the replacement
+};
+
+#define __ALT_STR(x)	#x
+#define ALT_STR(x)	__ALT_STR(x)
+
+#ifdef JOS_KERNEL
+// An asm string: 'old', padded with NOPs to the length of 'new' if
+// that is longer, and the entry for patching in 'new'.  (In gas, a
+// true comparison is -1, hence the negation.)
+#define ALTERNATIVE(old, new, feat)					\
+	"661:\n\t" old "\n662:\n\t"					\
+	".skip -(((665f-664f)-(662b-661b)) > 0) * "			\
+		"((665f-664f)-(662b-661b)),0x90\n"			\
+	"663:\n\t"							\
+	".pushsection .altinstructions,\"a\"\n\t"			\
+	".long 661b\n\t"						\
+	".long 664f\n\t"						\
+	".short " ALT_STR(feat) "\n\t"					\
+	".byte 663b-661b\n\t"						\
+	".byte 665f-664f\n\t"						\
+	".popsection\n\t"						\
+	".pushsection .altinstr_replacement,\"a\"\n"			\
+	"664:\n\t" new "\n665:\n\t"					\
+	".popsection\n"
+
+// Does the CPU have 'feat'?  A jmp to the false branch by default,
+// patched to NOPs on CPUs with the feature, so it is only meant for
+// tests whose answer never changes after boot.  'feat' must be a
+// constant.
+static inline __attribute__((always_inline)) bool
+static_cpu_has(int feat)
+{
+	asm goto(ALTERNATIVE("jmp %l[no]", "", %c0)
+		 : : "i" (feat) : : no);
+	return 1;
+no:
+	return 0;
+}
+#else
+#define ALTERNATIVE(old, new, feat)	old "\n"
+#define static_cpu_has(feat)		0
+#endif
+
+#endif /* !JOS_INC_ALTERNATIVE_H */
@@ -0,0 +1,146 @@
+#ifndef JOS_INC_ATOMIC_H
+#define JOS_INC_ATOMIC_H
+
+// Atomic read-modify-write operations and memory barriers.
+//
+// The operations are macros on any 1-, 2- or 4-byte integer or pointer
+// lvalue (and 8-byte ones on a 64-bit host), sized by the operand like
+// the instructions themselves.  Each is a locked instruction, which on
+// x86 is also a full memory barrier.
+//
+// Nothing here is kernel-specific, so the host unit tests in host/
+// build these headers natively as well.
+
+#include <inc/types.h>
+
+// Keep the compiler from moving memory accesses across this point.
+#define barrier()	asm volatile("" : : : "memory")
+
+// Memory barriers.  x86 only reorders a store with a later load, so
+// only mb() needs a fence; rmb() and wmb() just stop the compiler.
+// mb() is a locked no-op add to the stack top rather than mfence,
+// which needs SSE2.
+#ifdef __x86_64__
+#define mb()		asm volatile("lock; addl $0, (%%rsp)" : : : "memory", "cc")
+#else
+#define mb()		asm volatile("lock; addl $0, (%%esp)" : : : "memory", "cc")
+#endif
+#define rmb()		barrier()
+#define wmb()		barrier()
+
+// Read and write an lvalue exactly once, with acquire and release
+// ordering respectively.
+#define load_acquire(p) ({						\
+	typeof(*(p)) __v = *(volatile typeof(*(p)) *) (p);		\
+	barrier();							\
+	__v;								\
+})
+#define store_release(p, v) do {					\
+	barrier();							\
+	*(volatile typeof(*(p)) *) (p) = (v);				\
+} while (0)
+
+// Spin-wait hint: lets the other hyperthread run and avoids a memory
+// order mis-speculation when the loop exits.
+#define cpu_relax()	asm volatile("pause" : : : "memory")
+
+// *p = v; return the old *p.
+#define atomic_xchg(p, v) ({						\
+	typeof(*(p)) __v = (v);						\
+	asm volatile("xchg %0, %1"					\
+		     : "+q" (__v), "+m" (*(p)) : : "memory");		\
+	__v;								\
+})
+
+// If *p == old, *p = new.  Return the old *p either way, so the
+// exchange happened if the result is 'old'.
+#define atomic_cmpxchg(p, old, new) ({					\
+	typeof(*(p)) __old = (old), __new = (new);			\
+	asm volatile("lock; cmpxchg %2, %1"				\
+		     : "+a" (__old), "+m" (*(p))			\
+		     : "q" (__new) : "memory", "cc");			\
+	__old;								\
+})
+
+// *p += v; return the old *p.
+#define atomic_fetch_add(p, v) ({					\
+	typeof(*(p)) __v = (v);						\
+	asm volatile("lock; xadd %0, %1"				\
+		     : "+q" (__v), "+m" (*(p)) : : "memory", "cc");	\
+	__v;								\
+})
+
+// *p += v, *p |= v, *p &= v, without the old value, which saves
+// the compare-and-swap loop that atomic_fetch_or/and need.
+#define atomic_add(p, v) ({						\
+	typeof(*(p)) __v = (v);						\
+	asm volatile("lock; add %1, %0"					\
+		     : "+m" (*(p)) : "q" (__v) : "memory", "cc");	\
+})
+#define atomic_or(p, v) ({						\
+	typeof(*(p)) __v = (v);						\
+	asm volatile("lock; or %1, %0"					\
+		     : "+m" (*(p)) : "q" (__v) : "memory", "cc");	\
+})
+#define atomic_and(p, v) ({						\
+	typeof(*(p)) __v = (v);						\
+	asm volatile("lock; and %1, %0"					\
+		     : "+m" (*(p)) : "q" (__v) : "memory", "cc");	\
+})
+
+// *p |= v and *p &= v; return the old *p.
+#define atomic_fetch_or(p, v)	__atomic_fetch_op(p, v, |)
+#define atomic_fetch_and(p, v)	__atomic_fetch_op(p, v, &)
+#define __atomic_fetch_op(p, v, op) ({					\
+	typeof(*(p)) __o, __n, __v = (v);				\
+	do {								\
+		__o = *(volatile typeof(*(p)) *) (p);			\
+		__n = __o op __v;					\
+	} while (atomic_cmpxchg(p, __o, __n) != __o);			\
+	__o;								\
+})
+
+// 64-bit compare-and-swap with cmpxchg8b (Pentium and later).
+// Returns the old *p.
+static inline uint64_t
+atomic_cmpxchg64(volatile uint64_t *p, uint64_t old, uint64_t new)
+{
+	uint32_t lo = old, hi = old >> 32;
+
+	asm volatile("lock; cmpxchg8b %2"
+		     : "+a" (lo), "+d" (hi), "+m" (*p)
+		     : "b" ((uint32_t) new), "c" ((uint32_t) (new >> 32))
+		     : "memory", "cc");
+	return ((uint64_t) hi << 32) | lo;
+}
+
+// Atomically read a 64-bit value, which two 32-bit loads can tear:
+// a compare-and-swap that stores what is already there.
+static inline uint64_t
+atomic_read64(volatile uint64_t *p)
+{
+	return atomic_cmpxchg64(p, 0, 0);
+}
+
+// Compare-and-swap two adjacent words, p[0] and p[1], as one: for a
+// pointer and a generation count, say.  p must be aligned to the size
+// of both.  Returns whether the exchange happened.
+static inline bool
+atomic_cmpxchg2(volatile uintptr_t *p, uintptr_t old0, uintptr_t old1,
+		uintptr_t new0, uintptr_t new1)
+{
+	bool ok;
+
+#ifdef __x86_64__
+	asm volatile("lock; cmpxchg16b %1; sete %0"
+#else
+	asm volatile("lock; cmpxchg8b %1; sete %0"
+#endif
+		     : "=q" (ok), "+m" (*(volatile uintptr_t (*)[2]) p),
+		       "+a" (old0), "+d" (old1)
+		     : "b" (new0), "c" (new1)
+		     : "memory", "cc");
+	return ok;
+}
+
+#endif /* !JOS_INC_ATOMIC_H */
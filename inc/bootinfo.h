@@ -0,0 +1,64 @@
+#ifndef JOS_INC_BOOTINFO_H
+#define JOS_INC_BOOTINFO_H
+
+/*
+ * The boot loader leaves a struct Bootinfo at physical address
+ * BOOTINFO in low memory; the kernel copies it into its own
+ * 'bootinfo' early in i386_init (see kern/bootinfo.c).
+ */
+
+#define BOOTINFO	0x1000
+#define BOOTINFO_MAGIC	0xB0071AF0
+
+// Boot phases stamped with the TSC, as indices into bi_tsc.
+// The boot loader stamps the phases before BOOTPH_ENTRY.
+#define BOOTPH_LOADER	0	// boot block entered
+#define BOOTPH_A20	1	// A20 enabled (by stage 2)
+#define BOOTPH_SEG	2	// kernel segment i loaded: BOOTPH_SEG + i
+#define BOOTPH_MAXSEG	8
+#define BOOTPH_ENTRY	10	// kernel entered
+#define BOOTPH_BSS	11	// kernel BSS cleared
+#define BOOTPH_CONS	12	// console initialized
+#define BOOTPH_PROMPT	13	// first monitor prompt
+#define NBOOTPH		14
+
+// Field offsets, for assembly code.
+#define BOOTINFO_TSC(phase)	(8 + 8 * (phase))
+#define BOOTINFO_DRIVE		BOOTINFO_TSC(NBOOTPH)
+#define BOOTINFO_EDD_NSECT	(BOOTINFO_DRIVE + 2)
+#define BOOTINFO_NMEM		(BOOTINFO_EDD_NSECT + 2)
+#define BOOTINFO_MEM(i)		(BOOTINFO_NMEM + 4 + 20 * (i))
+
+// Physical memory map entries, as returned by INT 15h AX=E820h.
+#define BOOTINFO_MAXMEM	32
+#define BOOTMEM_RAM	1	// usable RAM
+#define BOOTMEM_RESERVED 2	// reserved (ROM, memory-mapped I/O, ...)
+#define BOOTMEM_ACPI	3	// ACPI tables, reclaimable once read
+#define BOOTMEM_NVS	4	// ACPI non-volatile storage
+#define BOOTMEM_BAD	5	// unusable
+
+#ifndef __ASSEMBLER__
+
+#include <inc/types.h>
+
+struct Bootmem {
+	uint64_t bm_addr;		// physical start address
+	uint64_t bm_len;		// length in bytes
+	uint32_t bm_type;		// BOOTMEM_*
+} __attribute__((packed));
+
+struct Bootinfo {
+	uint32_t bi_magic;		// BOOTINFO_MAGIC if filled in
+	uint32_t bi_nseg;		// number of BOOTPH_SEG stamps
+	uint64_t bi_tsc[NBOOTPH];	// TSC at each phase, 0 if not stamped
+	uint8_t bi_drive;		// BIOS boot drive number
+	uint8_t bi_reserved0;
+	uint16_t bi_edd_nsect;		// kernel sectors read with EDD
+	uint16_t bi_nmem;		// number of bi_mem entries
+	uint16_t bi_reserved1;
+	struct Bootmem bi_mem[BOOTINFO_MAXMEM];	// physical memory map
+};
+
+#endif /* !__ASSEMBLER__ */
+
+#endif /* !JOS_INC_BOOTINFO_H */
@@ -0,0 +1,304 @@
+#ifndef JOS_INC_LOCKFREE_H
+#define JOS_INC_LOCKFREE_H
+
+// Lock-free data structures on top of inc/atomic.h:
+//
+//   lf_stack	Treiber stack of caller-embedded nodes, any number of
+//		pushers and poppers.
+//   mpmc_ring	Bounded FIFO of pointers, any number of producers and
+//		consumers (D. Vyukov's sequence-numbered cells).
+//   spsc_ring	Bounded FIFO of pointers, one producer and one consumer.
+//   ws_deque	Bounded work-stealing deque of pointers: the owner pushes
+//		and pops at the bottom, any number of thieves steal from
+//		the top (Chase and Lev).
+//
+// None of them allocates: the caller provides nodes and ring storage.
+// Ring sizes are powers of two.  No operation waits for another CPU,
+// so they are safe to use from interrupt handlers.
+
+#include <inc/types.h>
+#include <inc/mmu.h>
+#include <inc/atomic.h>
+
+// --------------------------------------------------------------
+// Treiber stack
+// --------------------------------------------------------------
+
+struct lf_node {
+	struct lf_node *lf_next;
+};
+
+// The top of the stack and a count of pops, swapped together by
+// atomic_cmpxchg2.  The count keeps a pop from succeeding when the
+// top it read was popped and pushed back meanwhile (ABA).
+struct lf_stack {
+	struct lf_node *volatile top;
+	volatile uintptr_t npop;
+} __attribute__((aligned(2 * sizeof(uintptr_t))));
+
+static inline void
+lf_stack_init(struct lf_stack *s)
+{
+	s->top = NULL;
+	s->npop = 0;
+}
+
+static inline void
+lf_stack_push(struct lf_stack *s, struct lf_node *n)
+{
+	struct lf_node *top;
+
+	// Pushes need no count: a push only fails if 'top' moved.
+	do {
+		top = s->top;
+		n->lf_next = top;
+	} while (atomic_cmpxchg(&s->top, top, n) != top);
+}
+
+// Pop the top node, or return NULL if the stack is empty.
+// A popped node's memory must stay readable as long as another pop
+// might have read it as the top, so take nodes from type-stable memory
+// such as a slab cache, not straight from the page allocator.
+static inline struct lf_node *
+lf_stack_pop(struct lf_stack *s)
+{
+	struct lf_node *top;
+	uintptr_t npop;
+
+	do {
+		npop = s->npop;
+		rmb();
+		top = s->top;
+		if (top == NULL)
+			return NULL;
+	} while (!atomic_cmpxchg2((volatile uintptr_t *) s,
+				  (uintptr_t) top, npop,
+				  (uintptr_t) top->lf_next, npop + 1));
+	return top;
+}
+
+// --------------------------------------------------------------
+// Bounded multi-producer, multi-consumer ring
+// --------------------------------------------------------------
+
+// Cell i is free for the enqueue at position pos when its sequence
+// number is pos, and full for the dequeue at pos when it is pos + 1.
+// A dequeue sets it to pos + size, ready for the next lap.
+struct mpmc_cell {
+	volatile uint32_t seq;
+	void *data;
+};
+
+struct mpmc_ring {
+	volatile uint32_t enq __attribute__((aligned(CACHELINE)));
+	volatile uint32_t deq __attribute__((aligned(CACHELINE)));
+	uint32_t mask __attribute__((aligned(CACHELINE)));
+	struct mpmc_cell *cells;
+};
+
+// 'cells' is an array of 'size' cells, a power of two.
+static inline void
+mpmc_ring_init(struct mpmc_ring *r, struct mpmc_cell *cells, uint32_t size)
+{
+	uint32_t i;
+
+	for (i = 0; i < size; i++)
+		cells[i].seq = i;
+	r->cells = cells;
+	r->mask = size - 1;
+	r->enq = r->deq = 0;
+}
+
+// Add 'data' at the tail.  Returns false if the ring is full.
+static inline bool
+mpmc_ring_enqueue(struct mpmc_ring *r, void *data)
+{
+	struct mpmc_cell *c;
+	uint32_t pos = r->enq, seq;
+	int32_t dif;
+
+	for (;;) {
+		c = &r->cells[pos & r->mask];
+		seq = load_acquire(&c->seq);
+		dif = (int32_t) (seq - pos);
+		if (dif == 0) {
+			if (atomic_cmpxchg(&r->enq, pos, pos + 1) == pos)
+				break;
+			pos = r->enq;
+		} else if (dif < 0)
+			return false;
+		else
+			pos = r->enq;
+	}
+	c->data = data;
+	store_release(&c->seq, pos + 1);
+	return true;
+}
+
+// Remove the head into *data.  Returns false if the ring is empty.
+static inline bool
+mpmc_ring_dequeue(struct mpmc_ring *r, void **data)
+{
+	struct mpmc_cell *c;
+	uint32_t pos = r->deq, seq;
+	int32_t dif;
+
+	for (;;) {
+		c = &r->cells[pos & r->mask];
+		seq = load_acquire(&c->seq);
+		dif = (int32_t) (seq - (pos + 1));
+		if (dif == 0) {
+			if (atomic_cmpxchg(&r->deq, pos, pos + 1) == pos)
+				break;
+			pos = r->deq;
+		} else if (dif < 0)
+			return false;
+		else
+			pos = r->deq;
+	}
+	*data = c->data;
+	store_release(&c->seq, pos + r->mask + 1);
+	return true;
+}
+
+// --------------------------------------------------------------
+// Bounded single-producer, single-consumer ring
+// --------------------------------------------------------------
+
+// 'head' is written only by the consumer and 'tail' only by the
+// producer, on cache lines of their own; each side keeps a copy of
+// the other's index and rereads it only when the ring looks full
+// (or empty), so it usually touches just its own line and the slot.
+struct spsc_ring {
+	volatile uint32_t head __attribute__((aligned(CACHELINE)));
+	uint32_t tail_cache;		// consumer's copy of tail
+	volatile uint32_t tail __attribute__((aligned(CACHELINE)));
+	uint32_t head_cache;		// producer's copy of head
+	uint32_t mask __attribute__((aligned(CACHELINE)));
+	void **slots;
+};
+
+// 'slots' is an array of 'size' pointers, a power of two.
+static inline void
+spsc_ring_init(struct spsc_ring *r, void **slots, uint32_t size)
+{
+	r->slots = slots;
+	r->mask = size - 1;
+	r->head = r->tail = 0;
+	r->head_cache = r->tail_cache = 0;
+}
+
+// Producer only.  Returns false if the ring is full.
+static inline bool
+spsc_ring_enqueue(struct spsc_ring *r, void *data)
+{
+	uint32_t tail = r->tail;
+
+	if (tail - r->head_cache > r->mask) {
+		r->head_cache = load_acquire(&r->head);
+		if (tail - r->head_cache > r->mask)
+			return false;
+	}
+	r->slots[tail & r->mask] = data;
+	store_release(&r->tail, tail + 1);
+	return true;
+}
+
+// Consumer only.  Returns false if the ring is empty.
+static inline bool
+spsc_ring_dequeue(struct spsc_ring *r, void **data)
+{
+	uint32_t head = r->head;
+
+	if (head == r->tail_cache) {
+		r->tail_cache = load_acquire(&r->tail);
+		if (head == r->tail_cache)
+			return false;
+	}
+	*data = r->slots[head & r->mask];
+	store_release(&r->head, head + 1);
+	return true;
+}
+
+// --------------------------------------------------------------
+// Bounded work-stealing deque
+// --------------------------------------------------------------
+
+// Items live in slots [top, bottom).  The owner works at the bottom
+// end like a stack; thieves take the oldest item from the top.  Only
+// when one item is left do the owner and a thief race for it, both
+// with a compare-and-swap on 'top'.
+struct ws_deque {
+	volatile uint32_t top __attribute__((aligned(CACHELINE)));
+	volatile uint32_t bottom __attribute__((aligned(CACHELINE)));
+	uint32_t mask __attribute__((aligned(CACHELINE)));
+	void *volatile *slots;
+};
+
+// 'slots' is an array of 'size' pointers, a power of two.
+static inline void
+ws_deque_init(struct ws_deque *d, void **slots, uint32_t size)
+{
+	d->slots = (void *volatile *) slots;
+	d->mask = size - 1;
+	d->top = d->bottom = 0;
+}
+
+// Owner only.  Returns false if the deque is full.
+static inline bool
+ws_deque_push(struct ws_deque *d, void *data)
+{
+	uint32_t b = d->bottom;
+
+	if (b - load_acquire(&d->top) > d->mask)
+		return false;
+	d->slots[b & d->mask] = data;
+	store_release(&d->bottom, b + 1);
+	return true;
+}
+
+// Owner only.  Returns the newest item, or NULL if there is none.
+static inline void *
+ws_deque_pop(struct ws_deque *d)
+{
+	uint32_t b = d->bottom - 1, t;
+	void *data;
+
+	// Claim the bottom slot before looking at 'top': a store
+	// followed by a load of another location, which only a full
+	// barrier keeps in order.
+	atomic_xchg(&d->bottom, b);
+	t = d->top;
+	if ((int32_t) (b - t) < 0) {
+		// empty
+		d->bottom = b + 1;
+		return NULL;
+	}
+	data = d->slots[b & d->mask];
+	if (b != t)
+		return data;
+	// The last item: race any thief for it.
+	if (atomic_cmpxchg(&d->top, t, t + 1) != t)
+		data = NULL;
+	d->bottom = b + 1;
+	return data;
+}
+
+// Any CPU.  Returns the oldest item, or NULL if the deque is empty or
+// another CPU took the item first.
+static inline void *
+ws_deque_steal(struct ws_deque *d)
+{
+	uint32_t t = load_acquire(&d->top), b;
+	void *data;
+
+	b = load_acquire(&d->bottom);
+	if ((int32_t) (b - t) <= 0)
+		return NULL;
+	data = d->slots[t & d->mask];
+	if (atomic_cmpxchg(&d->top, t, t + 1) != t)
+		return NULL;
+	return data;
+}
+
+#endif /* !JOS_INC_LOCKFREE_H */
@@ -17,6 +17,8 @@
 #define GD_UT     0x18     // user text
 #define GD_UD     0x20     // user data
 #define GD_TSS0   0x28     // Task segment selector for CPU 0
+// The per-CPU data segment selectors, GD_PERCPU0 (kern/cpu.h) on up,
+// follow one TSS selector per CPU.
 
 /*
  * Virtual memory map:                                Permissions
@@ -138,10 +140,44 @@
 // The location of the user-level STABS data structure
 #define USTABDATA	(PTSIZE / 2)
 
+// Physical address of startup code for non-boot CPUs (APs)
+#define MPENTRY_PADDR	0x7000
+
 #ifndef __ASSEMBLER__
 
 typedef uint32_t pte_t;
 typedef uint32_t pde_t;
 
+/*
+ * Page descriptor structures, mapped at UPAGES.
+ * Read/write to the kernel, read-only to user programs.
+ *
+ * Each struct PageInfo stores metadata for one physical page.
+ * Is it NOT the physical page itself, but there is a one-to-one
+ * correspondence between physical pages and struct PageInfo's.
+ * You can map a struct PageInfo * to the corresponding physical address
+ * with page2pa() in kern/pmap.h.
+ *
+ * Free pages are kept in blocks of 2^order pages by the buddy
+ * allocator in kern/pmap.c.  Only the first page of a free block is
+ * on a free list and has PP_FREE set; pp_order is its order.
+ */
+struct PageInfo {
+	// Next and previous blocks on the free list of the same order.
+	struct PageInfo *pp_link;
+	struct PageInfo *pp_prev;
+
+	// pp_ref is the count of pointers (usually in page table entries)
+	// to this page, for pages allocated using page_alloc.
+	// Pages allocated at boot time using pmap.c's
+	// boot_alloc do not have valid reference count fields.
+
+	uint16_t pp_ref;
+	uint8_t pp_order;	// log2 of the block size in pages
+	uint8_t pp_flags;	// PP_*
+};
+
+#define PP_FREE		0x01	// first page of a free block
+
 #endif /* !__ASSEMBLER__ */
 #endif /* !JOS_INC_MEMLAYOUT_H */
@@ -20,6 +20,16 @@ void *	memmove(void *dst, const void *src, size_t len);
 int	memcmp(const void *s1, const void *s2, size_t len);
 void *	memfind(const void *s, int c, size_t len);
 
+// CPU features that memcpy, memmove and memset may use, outside the
+// kernel, once string_select says the CPU has them.  The kernel
+// patches its copies at boot instead (inc/alternative.h).
+#define STR_SSE2	0x1	// 16-byte SSE2 loads and stores
+#define STR_ERMS	0x2	// Fast rep movsb/stosb for large sizes
+#define STR_FSRM	0x4	// Fast rep movsb for short sizes too
+#ifndef JOS_KERNEL
+void	string_select(int features);
+#endif
+
 long	strtol(const char *s, char **endptr, int base);
 
 #endif /* not JOS_INC_STRING_H */
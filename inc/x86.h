@@ -2,6 +2,8 @@
 #define JOS_INC_X86_H
 
 #include <inc/types.h>
+#include <inc/mmu.h>
+#include <inc/alternative.h>
 
 static inline void
 breakpoint(void)
@@ -185,6 +187,8 @@ rcr4(void)
 	return cr4;
 }
 
+// Flush the TLB by reloading CR3.  Global (PTE_G) entries survive;
+// toggling CR4_PGE flushes those too.
 static inline void
 tlbflush(void)
 {
@@ -223,13 +227,15 @@ read_esp(void)
 	return esp;
 }
 
+// CPUID leaf 'info', sub-leaf 'index' (for leaves that have them, like 7).
 static inline void
-cpuid(uint32_t info, uint32_t *eaxp, uint32_t *ebxp, uint32_t *ecxp, uint32_t *edxp)
+cpuid_count(uint32_t info, uint32_t index, uint32_t *eaxp, uint32_t *ebxp,
+	    uint32_t *ecxp, uint32_t *edxp)
 {
 	uint32_t eax, ebx, ecx, edx;
 	asm volatile("cpuid"
 		     : "=a" (eax), "=b" (ebx), "=c" (ecx), "=d" (edx)
-		     : "a" (info));
+		     : "a" (info), "c" (index));
 	if (eaxp)
 		*eaxp = eax;
 	if (ebxp)
@@ -240,6 +246,45 @@ cpuid(uint32_t info, uint32_t *eaxp, uint32_t *ebxp, uint32_t *ecxp, uint32_t *e
 		*edxp = edx;
 }
 
+static inline void
+cpuid(uint32_t info, uint32_t *eaxp, uint32_t *ebxp, uint32_t *ecxp, uint32_t *edxp)
+{
+	cpuid_count(info, 0, eaxp, ebxp, ecxp, edxp);
+}
+
+// CPUID feature flags, numbered FEAT(word, bit) for cpu_has() in
+// kern/cpu.h.  Word 0 is leaf 1's EDX, 1 its ECX, 2 leaf 7's EBX and
+// 3 leaf 7's EDX.
+#define NFEATWORD	4
+#define FEAT(word, bit)	((word) * 32 + (bit))
+
+#define FEAT_PGE	FEAT(0, 13)	// Global pages
+#define FEAT_CMOV	FEAT(0, 15)	// cmov, and so a P6 or later
+#define FEAT_FXSR	FEAT(0, 24)	// fxsave/fxrstor
+#define FEAT_SSE	FEAT(0, 25)
+#define FEAT_SSE2	FEAT(0, 26)
+#define FEAT_ERMS	FEAT(2, 9)	// Enhanced rep movsb/stosb
+#define FEAT_FSRM	FEAT(3, 4)	// Fast short rep movsb
+
+// Flush the whole TLB, global (PTE_G) entries too, which tlbflush
+// leaves alone.  Toggling CR4_PGE does that on CPUs with global pages;
+// the others have no global entries to flush.
+static inline void
+tlbflush_global(void)
+{
+	uint32_t cr4;
+
+	if (static_cpu_has(FEAT_PGE)) {
+		asm volatile("movl %%cr4,%0" : "=r" (cr4));
+		if (cr4 & CR4_PGE) {
+			asm volatile("movl %0,%%cr4" : : "r" (cr4 & ~CR4_PGE));
+			asm volatile("movl %0,%%cr4" : : "r" (cr4) : "memory");
+			return;
+		}
+	}
+	tlbflush();
+}
+
 static inline uint64_t
 read_tsc(void)
 {
@@ -0,0 +1,75 @@
+// Boot-time patching of alternative instructions (inc/alternative.h).
+
+#include <inc/types.h>
+#include <inc/assert.h>
+#include <inc/stdio.h>
+#include <inc/x86.h>
+#include <inc/alternative.h>
+
+#include <kern/cpu.h>
+
+extern struct Alternative __alt_start[], __alt_end[];
+
+// NOPs of 1 to ALT_NOPMAX bytes, one instruction each.  The long ones
+// are the 0F 1F forms every P6 and later CPU decodes; older ones get
+// strings of one-byte NOPs.
+#define ALT_NOPMAX	8
+
+static const uint8_t p6_nops[ALT_NOPMAX][ALT_NOPMAX] = {
+	{ 0x90 },
+	{ 0x66, 0x90 },
+	{ 0x0f, 0x1f, 0x00 },
+	{ 0x0f, 0x1f, 0x40, 0x00 },
+	{ 0x0f, 0x1f, 0x44, 0x00, 0x00 },
+	{ 0x66, 0x0f, 0x1f, 0x44, 0x00, 0x00 },
+	{ 0x0f, 0x1f, 0x80, 0x00, 0x00, 0x00, 0x00 },
+	{ 0x0f, 0x1f, 0x84, 0x00, 0x00, 0x00, 0x00, 0x00 },
+};
+
+// Copy code with a plain loop: memcpy is itself patched.
+static void
+text_copy(uint8_t *dst, const uint8_t *src, int n)
+{
+	while (n-- > 0)
+		*(volatile uint8_t *) dst++ = *src++;
+}
+
+static void
+text_nops(uint8_t *dst, int n)
+{
+	int k;
+
+	while (n > 0) {
+		k = cpu_has(FEAT_CMOV) ? MIN(n, ALT_NOPMAX) : 1;
+		text_copy(dst, p6_nops[k - 1], k);
+		dst += k;
+		n -= k;
+	}
+}
+
+// Patch in the replacements for the features this CPU has.  Runs
+// once on the boot CPU, before the rest of the kernel and before any
+// other CPU starts, so no code is modified while something runs it.
+void
+apply_alternatives(void)
+{
+	struct Alternative *a;
+	uint8_t *instr;
+	int npatch = 0;
+
+	for (a = __alt_start; a < __alt_end; a++) {
+		if (!cpu_has(a->a_feat))
+			continue;
+		if (a->a_repllen > a->a_instrlen)
+			panic("alternative at %08x: replacement too long",
+			      a->a_instr);
+		instr = (uint8_t *) a->a_instr;
+		text_copy(instr, (const uint8_t *) a->a_repl, a->a_repllen);
+		text_nops(instr + a->a_repllen, a->a_instrlen - a->a_repllen);
+		npatch++;
+	}
+	// cpuid serializes, so no stale prefetched code runs.
+	cpuid(0, NULL, NULL, NULL, NULL);
+	cprintf("alternatives: patched %d of %d sites\n", npatch,
+		(int) (__alt_end - __alt_start));
+}
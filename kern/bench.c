@@ -0,0 +1,456 @@
+// Micro-benchmarks run from the kernel monitor's 'bench' command.
+
+#include <inc/stdio.h>
+#include <inc/string.h>
+#include <inc/mmu.h>
+#include <inc/x86.h>
+
+#include <kern/monitor.h>
+#include <kern/tsc.h>
+#include <kern/cpu.h>
+#include <kern/pmap.h>
+#include <kern/taskpool.h>
+
+struct Bench {
+	const char *name;
+	const char *desc;
+	void (*func)(int argc, char **argv);
+};
+
+static void bench_tlb(int argc, char **argv);
+static void bench_cpunum(int argc, char **argv);
+static void bench_zero(int argc, char **argv);
+static void bench_mem(int argc, char **argv);
+static void bench_page(int argc, char **argv);
+
+static struct Bench benches[] = {
+	{ "tlb", "CR3 reloads with and without global 4KB pages", bench_tlb },
+	{ "cpunum", "CPU lookup through %gs and through the LAPIC", bench_cpunum },
+	{ "zero", "Zeroing memory on one CPU and on all of them", bench_zero },
+	{ "mem", "memcpy, memmove and memset by size and alignment", bench_mem },
+	{ "page", "clear_page/copy_page against memset/memcpy, and after", bench_page },
+};
+
+// Return the optional iteration count in argv[0], or 'def'.
+static int
+bench_iters(int argc, char **argv, int def)
+{
+	long n;
+
+	if (argc < 1 || (n = strtol(argv[0], NULL, 0)) <= 0)
+		return def;
+	return n;
+}
+
+static void
+bench_report(const char *what, uint64_t cycles, int iters)
+{
+	cprintf("  %-24s %10llu cycles/iter", what, cycles / iters);
+	if (tsc_khz)
+		cprintf("  %8llu us total", tsc_to_us(cycles));
+	cprintf("\n");
+}
+
+/***** TLB *****/
+
+// The kernel and the direct map are 4MB pages, only a few TLB entries
+// however much is touched, so the benchmark maps the first 4MB of
+// physical memory again at UTEMP, one 4KB page at a time.
+#define TLB_NPAGES	NPTENTRIES
+
+// Map the scratch pages, global, in one new page table.  They all
+// share it, so only the first pgdir_walk can fail.
+static bool
+tlb_map(void)
+{
+	pte_t *pte;
+	int i;
+
+	if (kern_pgdir[PDX(UTEMP)] & PTE_P)
+		return false;
+	for (i = 0; i < TLB_NPAGES; i++) {
+		if (!(pte = pgdir_walk(kern_pgdir, (char *) UTEMP + i * PGSIZE, 1)))
+			return false;
+		*pte = (i * PGSIZE) | PTE_G | PTE_P;
+	}
+	return true;
+}
+
+// Free the page table again, and the TLB entries, global ones too.
+static void
+tlb_unmap(void)
+{
+	pde_t *pde = &kern_pgdir[PDX(UTEMP)];
+
+	page_decref(pa2page(PTE_ADDR(*pde)));
+	*pde = 0;
+	tlbflush_global();
+}
+
+// Reload CR3, then touch every scratch page.
+static uint64_t
+tlb_run(int iters)
+{
+	volatile char *p, *lim = (char *) UTEMP + TLB_NPAGES * PGSIZE;
+	uint32_t cr3 = rcr3();
+	uint64_t t0;
+	int i;
+
+	t0 = read_tsc();
+	for (i = 0; i < iters; i++) {
+		lcr3(cr3);
+		for (p = UTEMP; p < lim; p += PGSIZE)
+			(void) *p;
+	}
+	return read_tsc() - t0;
+}
+
+// Usage: bench tlb [iters]
+// Runs the same loop with CR4_PGE cleared (so PTE_G is ignored and
+// every CR3 reload drops the scratch translations) and set.
+static void
+bench_tlb(int argc, char **argv)
+{
+	uint32_t cr4 = rcr4();
+	int iters = bench_iters(argc, argv, 10000);
+	uint64_t t;
+
+	if (!tlb_map()) {
+		cprintf("  cannot map scratch pages at UTEMP\n");
+		return;
+	}
+	cprintf("%d iterations, %d 4KB pages\n", iters, TLB_NPAGES);
+
+	lcr4(cr4 & ~CR4_PGE);
+	tlb_run(iters / 10 + 1);
+	t = tlb_run(iters);
+	lcr4(cr4);
+	bench_report("non-global", t, iters);
+
+	if (!(cr4 & CR4_PGE))
+		cprintf("  global pages not enabled on this CPU\n");
+	else {
+		tlb_run(iters / 10 + 1);
+		t = tlb_run(iters);
+		bench_report("global", t, iters);
+	}
+	tlb_unmap();
+}
+
+/***** Per-CPU data *****/
+
+// Usage: bench cpunum [iters]
+// Compares cpunum(), one %gs-relative load, with lapic_cpunum(), an
+// uncached LAPIC register read plus a table lookup.
+static void
+bench_cpunum(int argc, char **argv)
+{
+	int iters = bench_iters(argc, argv, 1000000);
+	volatile int sink;
+	uint64_t t0;
+	int i;
+
+	cprintf("%d iterations\n", iters);
+
+	t0 = read_tsc();
+	for (i = 0; i < iters; i++)
+		sink = cpunum();
+	bench_report("cpunum (%gs)", read_tsc() - t0, iters);
+
+	if (!lapicaddr) {
+		cprintf("  no local APIC\n");
+		return;
+	}
+	t0 = read_tsc();
+	for (i = 0; i < iters; i++)
+		sink = lapic_cpunum();
+	bench_report("lapic_cpunum", read_tsc() - t0, iters);
+}
+
+/***** Parallel zeroing *****/
+
+#define ZERO_ORDER	(NPAGEORDER - 1)	// allocate 4MB blocks
+#define ZERO_MAXBLOCK	64
+#define ZERO_GRAIN	16			// pages per task
+#define ZERO_REPS	4
+
+static struct PageInfo *zero_blocks[ZERO_MAXBLOCK];
+
+// Zero pages [lo, hi) of the blocks, counted end to end.
+static void
+zero_range(void *arg, uint32_t lo, uint32_t hi)
+{
+	uint32_t off, n;
+
+	while (lo < hi) {
+		off = lo & ((1 << ZERO_ORDER) - 1);
+		n = MIN(hi - lo, (1 << ZERO_ORDER) - off);
+		memset(page2kva(zero_blocks[lo >> ZERO_ORDER] + off), 0,
+		       n * PGSIZE);
+		lo += n;
+	}
+}
+
+static uint64_t
+zero_run(uint32_t npg, bool parallel)
+{
+	uint64_t t0;
+	int i;
+
+	t0 = read_tsc();
+	for (i = 0; i < ZERO_REPS; i++)
+		if (parallel)
+			task_parallel_for(0, npg, ZERO_GRAIN, zero_range, NULL);
+		else
+			zero_range(NULL, 0, npg);
+	return read_tsc() - t0;
+}
+
+// Usage: bench zero [MB]
+// Zeroes the same memory, 32MB by default, with memset on this CPU
+// and with task_parallel_for on all of them.
+static void
+bench_zero(int argc, char **argv)
+{
+	int mb = bench_iters(argc, argv, 32), nblock, i;
+	uint64_t ts, tp;
+	uint32_t npg;
+
+	nblock = MIN(ROUNDUP(mb, 4) / 4, ZERO_MAXBLOCK);
+	for (i = 0; i < nblock; i++)
+		if (!(zero_blocks[i] = page_alloc_order(ZERO_ORDER, 0)))
+			break;
+	nblock = i;
+	if (nblock == 0) {
+		cprintf("  no free 4MB blocks\n");
+		return;
+	}
+	npg = nblock << ZERO_ORDER;
+	cprintf("%dMB, %d CPUs (%d workers)\n", nblock * 4, ncpu,
+		taskpool_nworkers());
+
+	zero_run(npg, false);
+	ts = zero_run(npg, false);
+	bench_report("serial, per page", ts, ZERO_REPS * npg);
+	zero_run(npg, true);
+	tp = zero_run(npg, true);
+	bench_report("parallel, per page", tp, ZERO_REPS * npg);
+	if (tp)
+		cprintf("  speedup %llu.%02llux\n", ts / tp, ts * 100 / tp % 100);
+	taskpool_print_stats();
+
+	for (i = 0; i < nblock; i++)
+		page_free_order(zero_blocks[i], ZERO_ORDER);
+}
+
+/***** memcpy, memmove, memset *****/
+
+#define MEM_ORDER	6		// 256KB of buffers
+#define MEM_BYTES	(4 << 20)	// bytes moved per cell
+
+static const uint32_t mem_sizes[] = { 15, 64, 255, 1024, 3840, 4001, 65536 };
+// (dst, src) offsets from word alignment
+static const uint8_t mem_offs[][2] = { { 0, 0 }, { 1, 1 }, { 1, 0 }, { 0, 3 } };
+
+enum { MEM_CPY, MEM_MOVE, MEM_SET };
+
+static uint64_t
+mem_run(int op, char *dst, char *src, uint32_t n, int iters)
+{
+	uint64_t t0;
+	int i;
+
+	t0 = read_tsc();
+	for (i = 0; i < iters; i++)
+		switch (op) {
+		case MEM_CPY:
+			memcpy(dst, src, n);
+			break;
+		case MEM_MOVE:
+			memmove(dst, src, n);
+			break;
+		case MEM_SET:
+			memset(dst, i, n);
+			break;
+		}
+	return read_tsc() - t0;
+}
+
+// Usage: bench mem
+// Prints cycles per call for each size and (dst, src) misalignment.
+// memcpy copies between disjoint buffers; memmove copies up by 64
+// bytes within one buffer, so it takes the backward path.
+static void
+bench_mem(int argc, char **argv)
+{
+	static const char *names[] = { "memcpy", "memmove", "memset" };
+	struct PageInfo *pp;
+	char *buf;
+	int op, i, j, iters;
+	uint32_t n;
+
+	if (!(pp = page_alloc_order(MEM_ORDER, 0))) {
+		cprintf("  out of memory\n");
+		return;
+	}
+	buf = page2kva(pp);
+
+	cprintf("CPU has:%s%s%s%s\n", cpu_has(FEAT_SSE2) ? " sse2" : "",
+		cpu_has(FEAT_ERMS) ? " erms" : "",
+		cpu_has(FEAT_FSRM) ? " fsrm" : "",
+		cpu_has(FEAT_SSE2) || cpu_has(FEAT_ERMS) ? "" : " none of sse2, erms, fsrm");
+	cprintf("cycles per call; columns are (dst, src) offsets\n");
+	for (op = MEM_CPY; op <= MEM_SET; op++) {
+		cprintf("%-8s %6s", names[op], "size");
+		for (j = 0; j < ARRAY_SIZE(mem_offs); j++)
+			if (op != MEM_SET)
+				cprintf("   (%d, %d)", mem_offs[j][0], mem_offs[j][1]);
+			else if (mem_offs[j][1] == 0)
+				cprintf("    (%d)  ", mem_offs[j][0]);
+		cprintf("\n");
+		for (i = 0; i < ARRAY_SIZE(mem_sizes); i++) {
+			n = mem_sizes[i];
+			iters = MAX(MEM_BYTES / n, 1);
+			cprintf("%8s %6u", "", n);
+			for (j = 0; j < ARRAY_SIZE(mem_offs); j++) {
+				char *d = buf + mem_offs[j][0], *s;
+
+				if (op == MEM_SET && mem_offs[j][1] != 0)
+					continue;
+				s = buf + (PGSIZE << MEM_ORDER) / 2 + mem_offs[j][1];
+				if (op == MEM_MOVE) {
+					s = buf + mem_offs[j][1];
+					d = s + 64 + mem_offs[j][0];
+				}
+				mem_run(op, d, s, n, iters / 10 + 1);
+				cprintf(" %9llu",
+					mem_run(op, d, s, n, iters) / iters);
+			}
+			cprintf("\n");
+		}
+	}
+	page_free_order(pp, MEM_ORDER);
+}
+
+/***** Whole pages *****/
+
+#define PG_ORDER	9		// 2MB to clear, or copy to and from
+#define PG_HOTORDER	6		// 256KB of data the workload reuses
+#define PG_NPAGE	(1 << PG_ORDER)
+
+enum { PG_MEMSET, PG_CLEAR, PG_MEMCPY, PG_COPY };
+
+// Read a word from every cache line of the hot buffer.
+static uint64_t
+page_hot_pass(volatile uint32_t *hot)
+{
+	uint32_t i, n = (PGSIZE << PG_HOTORDER) / sizeof(*hot);
+	uint64_t t0;
+
+	t0 = read_tsc();
+	for (i = 0; i < n; i += CACHELINE / sizeof(*hot))
+		(void) hot[i];
+	return read_tsc() - t0;
+}
+
+static uint64_t
+page_run(int op, char *dst, char *src)
+{
+	uint64_t t0;
+	int i;
+
+	t0 = read_tsc();
+	for (i = 0; i < PG_NPAGE; i++, dst += PGSIZE, src += PGSIZE)
+		switch (op) {
+		case PG_MEMSET:
+			memset(dst, 0, PGSIZE);
+			break;
+		case PG_CLEAR:
+			clear_page(dst);
+			break;
+		case PG_MEMCPY:
+			memcpy(dst, src, PGSIZE);
+			break;
+		case PG_COPY:
+			copy_page(dst, src);
+			break;
+		}
+	return read_tsc() - t0;
+}
+
+// Usage: bench page
+// Times clearing or copying 2MB a page at a time, and then a pass
+// over 256KB of data read just before: the second time shows how
+// much of that data the page operation pushed out of the caches.
+static void
+bench_page(int argc, char **argv)
+{
+	static const char *names[] = {
+		"memset", "clear_page", "memcpy", "copy_page"
+	};
+	struct PageInfo *dpp, *spp, *hpp;
+	uint64_t t, thot, tcold;
+	char *dst, *src, *hot;
+	int op, i;
+
+	dpp = page_alloc_order(PG_ORDER, 0);
+	spp = page_alloc_order(PG_ORDER, 0);
+	hpp = page_alloc_order(PG_HOTORDER, 0);
+	if (!dpp || !spp || !hpp) {
+		cprintf("  out of memory\n");
+		goto out;
+	}
+	dst = page2kva(dpp);
+	src = page2kva(spp);
+	hot = page2kva(hpp);
+	memset(src, 1, PGSIZE << PG_ORDER);
+	memset(hot, 2, PGSIZE << PG_HOTORDER);
+
+	// The hot pass with nothing in between, for reference.
+	page_hot_pass((uint32_t *) hot);
+	thot = page_hot_pass((uint32_t *) hot);
+	cprintf("%dKB of pages; %dKB hot data, %llu cycles to read alone\n",
+		(PGSIZE << PG_ORDER) / 1024, (PGSIZE << PG_HOTORDER) / 1024,
+		thot);
+	cprintf("  %-12s %12s %16s\n", "", "cycles/page", "hot pass after");
+	for (op = PG_MEMSET; op <= PG_COPY; op++) {
+		page_run(op, dst, src);
+		page_hot_pass((uint32_t *) hot);
+		t = page_run(op, dst, src);
+		tcold = page_hot_pass((uint32_t *) hot);
+		cprintf("  %-12s %12llu %16llu\n", names[op], t / PG_NPAGE,
+			tcold);
+	}
+	if (!cpu_has(FEAT_SSE2))
+		cprintf("  no SSE2: clear_page and copy_page use rep stosl/movsl\n");
+
+out:
+	if (dpp)
+		page_free_order(dpp, PG_ORDER);
+	if (spp)
+		page_free_order(spp, PG_ORDER);
+	if (hpp)
+		page_free_order(hpp, PG_HOTORDER);
+}
+
+/***** Monitor command *****/
+
+int
+mon_bench(int argc, char **argv, struct Trapframe *tf)
+{
+	int i;
+
+	if (tsc_khz == 0)
+		tsc_calibrate();
+	if (argc >= 2)
+		for (i = 0; i < ARRAY_SIZE(benches); i++)
+			if (strcmp(argv[1], benches[i].name) == 0) {
+				benches[i].func(argc - 2, argv + 2);
+				return 0;
+			}
+
+	cprintf("Usage: bench <name> [args]\n");
+	for (i = 0; i < ARRAY_SIZE(benches); i++)
+		cprintf("  %-8s %s\n", benches[i].name, benches[i].desc);
+	return 0;
+}
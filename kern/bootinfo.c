@@ -0,0 +1,112 @@
+// Information passed from the boot loader, and boot-phase timestamps.
+
+#include <inc/x86.h>
+#include <inc/mmu.h>
+#include <inc/memlayout.h>
+#include <inc/string.h>
+
+#include <kern/bootinfo.h>
+
+// Passed in %eax and %ebx by a multiboot loader such as GRUB.
+#define MULTIBOOT_BOOTLOADER_MAGIC	0x2BADB002
+#define MULTIBOOT_INFO_MEMORY		0x001	// mi_mem_lower/upper valid
+#define MULTIBOOT_INFO_MMAP		0x040	// mi_mmap_* valid
+
+struct Multiboot_info {
+	uint32_t mi_flags;
+	uint32_t mi_mem_lower;		// KB of memory from 0
+	uint32_t mi_mem_upper;		// KB of memory from 1MB
+	uint32_t mi_unused[8];
+	uint32_t mi_mmap_length;	// bytes of memory map
+	uint32_t mi_mmap_addr;		// physical address of memory map
+};
+
+// Memory map entries are preceded by their size, not counting itself.
+struct Multiboot_mmap {
+	uint32_t mm_size;
+	struct Bootmem mm_mem;
+} __attribute__((packed));
+
+// entry.S stamps BOOTPH_ENTRY and saves the multiboot registers
+// before BSS is cleared, so keep these out of BSS.
+struct Bootinfo bootinfo __attribute__((section(".data")));
+uint32_t multiboot_magic __attribute__((section(".data")));
+uint32_t multiboot_info __attribute__((section(".data")));
+
+static void multiboot_init(void);
+
+// Copy what the boot loader left in low memory, if it is ours.
+// Another loader (e.g. GRUB) leaves no stamps behind, but may
+// describe memory through multiboot.
+void
+bootinfo_init(void)
+{
+	struct Bootinfo *bi = (struct Bootinfo *) (KERNBASE + BOOTINFO);
+	int i;
+
+	if (bi->bi_magic != BOOTINFO_MAGIC) {
+		multiboot_init();
+		return;
+	}
+	bootinfo.bi_magic = bi->bi_magic;
+	bootinfo.bi_drive = bi->bi_drive;
+	bootinfo.bi_edd_nsect = bi->bi_edd_nsect;
+	bootinfo.bi_nseg = MIN(bi->bi_nseg, (uint32_t) BOOTPH_MAXSEG);
+	memmove(bootinfo.bi_tsc, bi->bi_tsc,
+		(BOOTPH_SEG + bootinfo.bi_nseg) * sizeof(bi->bi_tsc[0]));
+	for (i = 0; i < MIN(bi->bi_nmem, BOOTINFO_MAXMEM); i++)
+		bootinfo_add_mem(bi->bi_mem[i].bm_addr, bi->bi_mem[i].bm_len,
+			    bi->bi_mem[i].bm_type);
+}
+
+// Take the memory map from a multiboot loader.  The information
+// must lie in the low 4MB, which entry_pgdir always maps.
+static void
+multiboot_init(void)
+{
+	struct Multiboot_info *mi;
+	struct Multiboot_mmap *mm;
+	uint32_t pa, end;
+
+	if (multiboot_magic != MULTIBOOT_BOOTLOADER_MAGIC
+	    || multiboot_info + sizeof(*mi) > PTSIZE)
+		return;
+	mi = (struct Multiboot_info *) (KERNBASE + multiboot_info);
+
+	if ((mi->mi_flags & MULTIBOOT_INFO_MMAP)
+	    && mi->mi_mmap_addr + mi->mi_mmap_length <= PTSIZE) {
+		pa = mi->mi_mmap_addr;
+		end = pa + mi->mi_mmap_length;
+		while (pa + sizeof(*mm) <= end) {
+			mm = (struct Multiboot_mmap *) (KERNBASE + pa);
+			bootinfo_add_mem(mm->mm_mem.bm_addr, mm->mm_mem.bm_len,
+				    mm->mm_mem.bm_type);
+			pa += mm->mm_size + sizeof(mm->mm_size);
+		}
+	} else if (mi->mi_flags & MULTIBOOT_INFO_MEMORY) {
+		bootinfo_add_mem(0, mi->mi_mem_lower * 1024, BOOTMEM_RAM);
+		bootinfo_add_mem(EXTPHYSMEM, mi->mi_mem_upper * 1024, BOOTMEM_RAM);
+	}
+}
+
+// Append an entry to the memory map, dropping empty ones.
+void
+bootinfo_add_mem(uint64_t addr, uint64_t len, uint32_t type)
+{
+	struct Bootmem *bm;
+
+	if (len == 0 || bootinfo.bi_nmem == BOOTINFO_MAXMEM)
+		return;
+	bm = &bootinfo.bi_mem[bootinfo.bi_nmem++];
+	bm->bm_addr = addr;
+	bm->bm_len = len;
+	bm->bm_type = type;
+}
+
+// Record the TSC for 'phase' the first time it is reached.
+void
+boot_stamp(int phase)
+{
+	if (bootinfo.bi_tsc[phase] == 0)
+		bootinfo.bi_tsc[phase] = read_tsc();
+}
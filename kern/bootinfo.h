@@ -0,0 +1,15 @@
+#ifndef JOS_KERN_BOOTINFO_H
+#define JOS_KERN_BOOTINFO_H
+#ifndef JOS_KERNEL
+# error "This is a JOS kernel header; user programs should not #include it"
+#endif
+
+#include <inc/bootinfo.h>
+
+extern struct Bootinfo bootinfo;
+
+void bootinfo_init(void);
+void bootinfo_add_mem(uint64_t addr, uint64_t len, uint32_t type);
+void boot_stamp(int phase);
+
+#endif /* !JOS_KERN_BOOTINFO_H */
@@ -0,0 +1,139 @@
+// Per-CPU segmentation: the global descriptor table and each CPU's
+// task state segment.
+
+#include <inc/types.h>
+#include <inc/mmu.h>
+#include <inc/memlayout.h>
+#include <inc/x86.h>
+
+#include <kern/cpu.h>
+
+// Global descriptor table.
+//
+// Set up global descriptor table (GDT) with separate segments for
+// kernel mode and user mode.  Segments serve many purposes on the x86.
+// We don't use any of their memory-mapping capabilities, but we need
+// them to switch privilege levels.
+//
+// The kernel and user segments are identical except for the DPL.
+// To load the SS register, the CPL must equal the DPL.  Thus,
+// we must duplicate the segments for the user and the kernel.
+//
+// In particular, the last argument to the SEG macro used in the
+// definition of gdt specifies the Descriptor Privilege Level (DPL)
+// of that descriptor: 0 for kernel and 3 for user.
+//
+// Each CPU has its own TSS descriptor, from GD_TSS0 up, and its own
+// per-CPU data segment, from GD_PERCPU0 up.
+//
+struct Segdesc gdt[2 * NCPU + 5] =
+{
+	// 0x0 - unused (always faults -- for trapping NULL far pointers)
+	SEG_NULL,
+
+	// 0x8 - kernel code segment
+	[GD_KT >> 3] = SEG(STA_X | STA_R, 0x0, 0xffffffff, 0),
+
+	// 0x10 - kernel data segment
+	[GD_KD >> 3] = SEG(STA_W, 0x0, 0xffffffff, 0),
+
+	// 0x18 - user code segment
+	[GD_UT >> 3] = SEG(STA_X | STA_R, 0x0, 0xffffffff, 3),
+
+	// 0x20 - user data segment
+	[GD_UD >> 3] = SEG(STA_W, 0x0, 0xffffffff, 3),
+
+	// Per-CPU TSS descriptors (starting from GD_TSS0) and per-CPU
+	// data segments (starting from GD_PERCPU0) are initialized in
+	// cpu_init_percpu()
+	[GD_TSS0 >> 3] = SEG_NULL
+};
+
+struct Pseudodesc gdt_pd = {
+	sizeof(gdt) - 1, (unsigned long) gdt
+};
+
+uint32_t cpu_features[NFEATWORD];
+
+// Read the boot CPU's feature flags, before cpu_init_percpu acts on
+// them.  The APs are assumed to match it.
+void
+cpu_detect_features(void)
+{
+	uint32_t maxleaf;
+
+	cpuid(0, &maxleaf, NULL, NULL, NULL);
+	cpuid(1, NULL, NULL, &cpu_features[1], &cpu_features[0]);
+	if (maxleaf >= 7)
+		cpuid_count(7, 0, NULL, &cpu_features[2], NULL,
+			    &cpu_features[3]);
+
+	// Without fxsave there is no way to save SSE state, so don't
+	// touch SSE at all.
+	if (!cpu_has(FEAT_FXSR)) {
+		cpu_features[FEAT_SSE / 32] &= ~(1 << (FEAT_SSE % 32));
+		cpu_features[FEAT_SSE2 / 32] &= ~(1 << (FEAT_SSE2 % 32));
+	}
+}
+
+// Load the GDT and segment registers, this CPU's per-CPU data
+// segment, and its TSS.  Runs on every CPU before it takes any lock.
+// The boot CPU runs it first thing, as cpus[0]; the others find
+// themselves through the local APIC the boot CPU has mapped.
+void
+cpu_init_percpu(void)
+{
+	int i = lapic_cpunum();
+	struct CpuInfo *c = &cpus[i];
+	struct Taskstate *ts = &c->cpu_ts;
+
+	// Point this CPU's data segment at its CpuInfo, byte-granular
+	// so that a stray offset faults.
+	c->cpu_self = c;
+	gdt[(GD_PERCPU0 >> 3) + i] = SEG16(STA_W, (uint32_t) c,
+					   sizeof(struct CpuInfo) - 1, 0);
+
+	lgdt(&gdt_pd);
+	// GS addresses the per-CPU data (see percpu_read in kern/cpu.h).
+	// The kernel never uses FS, so we leave it set to the user data
+	// segment.
+	asm volatile("movw %%ax,%%gs" : : "a" (GD_PERCPU0 + (i << 3)));
+	asm volatile("movw %%ax,%%fs" : : "a" (GD_UD|3));
+	// The kernel does use ES, DS, and SS.  We'll change between
+	// the kernel and user data segments as needed.
+	asm volatile("movw %%ax,%%es" : : "a" (GD_KD));
+	asm volatile("movw %%ax,%%ds" : : "a" (GD_KD));
+	asm volatile("movw %%ax,%%ss" : : "a" (GD_KD));
+	// Load the kernel text segment into CS.
+	asm volatile("ljmp %0,$1f\n 1:\n" : : "i" (GD_KT));
+	// For good measure, clear the local descriptor table (LDT),
+	// since we don't use it.
+	lldt(0);
+
+	// Setup a TSS so that we get the right stack
+	// when we trap to the kernel: this CPU's stack under KSTACKTOP.
+	ts->ts_esp0 = KSTACKTOP - i * (KSTKSIZE + KSTKGAP);
+	ts->ts_ss0 = GD_KD;
+	ts->ts_iomb = sizeof(struct Taskstate);
+
+	// Initialize the TSS slot of the gdt.
+	gdt[(GD_TSS0 >> 3) + i] = SEG16(STS_T32A, (uint32_t) (ts),
+					sizeof(struct Taskstate) - 1, 0);
+	gdt[(GD_TSS0 >> 3) + i].sd_s = 0;
+
+	// Load the TSS selector (like other segment selectors, the
+	// bottom three bits are special; we leave them 0)
+	ltr(GD_TSS0 + (i << 3));
+
+	// Let the kernel's string routines use the SSE registers: a
+	// real FPU (no EM), no lazy switching (no TS), native FPU
+	// errors, and fxsave/fxrstor and SSE instructions enabled.
+	// The kernel is the only FPU user so far and runs with
+	// interrupts off, so nothing needs saving around its SSE use;
+	// when environments get FPU state, it has to be saved first.
+	if (cpu_has(FEAT_SSE2)) {
+		lcr0((rcr0() | CR0_MP | CR0_NE) & ~(CR0_EM | CR0_TS));
+		lcr4(rcr4() | CR4_OSFXSR | CR4_OSXMMEXCPT);
+		asm volatile("fninit");
+	}
+}
@@ -0,0 +1,99 @@
+#ifndef JOS_KERN_CPU_H
+#define JOS_KERN_CPU_H
+#ifndef JOS_KERNEL
+# error "This is a JOS kernel header; user programs should not #include it"
+#endif
+
+#include <inc/types.h>
+#include <inc/memlayout.h>
+#include <inc/mmu.h>
+#include <inc/x86.h>
+
+// Maximum number of CPUs
+#define NCPU  8
+
+// Values of status in struct CpuInfo
+enum {
+	CPU_UNUSED = 0,
+	CPU_STARTED,
+	CPU_HALTED,
+};
+
+// Per-CPU data segment selector for CPU 0; CPU i's is GD_PERCPU0 + 8*i.
+#define GD_PERCPU0	(GD_TSS0 + (NCPU << 3))
+
+// Per-CPU state
+struct CpuInfo {
+	uint8_t cpu_id;                 // Index into cpus[] below
+	uint8_t cpu_apicid;             // Local APIC ID
+	volatile unsigned cpu_status;   // The status of the CPU
+	struct CpuInfo *cpu_self;       // This CpuInfo, for thiscpu
+	struct Taskstate cpu_ts;        // Used by x86 to find stack for interrupt
+};
+
+// Initialized in mpconfig.c
+extern struct CpuInfo cpus[NCPU];
+extern int ncpu;                    // Total number of CPUs in the system
+extern struct CpuInfo *bootcpu;     // The boot-strap processor (BSP)
+extern physaddr_t lapicaddr;        // Physical MMIO address of the local APIC
+extern uint8_t cpu_by_apicid[256];  // Index into cpus[] by local APIC ID
+
+// Initialized in cpu.c
+extern uint32_t cpu_features[NFEATWORD];  // The boot CPU's CPUID flags
+
+// Per-CPU kernel stacks
+extern unsigned char percpu_kstacks[NCPU][KSTKSIZE];
+
+// Each CPU's CpuInfo is also its per-CPU data area: cpu_init_percpu
+// loads %gs with a segment based at it, so a 1-, 2- or 4-byte field of
+// the running CPU's CpuInfo is one %gs-relative mov away.  Only valid
+// on a CPU after cpu_init_percpu has run there.
+#define percpu_read(field) ({						\
+	typeof(((struct CpuInfo *) 0)->field) __v;			\
+	asm volatile("mov %%gs:%c1, %0"					\
+		     : "=q" (__v)					\
+		     : "i" (offsetof(struct CpuInfo, field)));		\
+	__v;								\
+})
+#define percpu_write(field, val) ({					\
+	typeof(((struct CpuInfo *) 0)->field) __v = (val);		\
+	asm volatile("mov %1, %%gs:%c0"					\
+		     : : "i" (offsetof(struct CpuInfo, field)), "q" (__v)	\
+		     : "memory");					\
+})
+// Add to a per-CPU counter; a single instruction, so interrupts on
+// this CPU cannot tear it, and no lock prefix is needed.
+#define percpu_add(field, val) ({					\
+	typeof(((struct CpuInfo *) 0)->field) __v = (val);		\
+	asm volatile("add %1, %%gs:%c0"					\
+		     : : "i" (offsetof(struct CpuInfo, field)), "q" (__v)	\
+		     : "memory", "cc");					\
+})
+
+// The running CPU's index in cpus[].
+static inline int
+cpunum(void)
+{
+	return percpu_read(cpu_id);
+}
+
+#define thiscpu		percpu_read(cpu_self)
+
+// Does the CPU have feature 'feat', a FEAT_ constant from inc/x86.h?
+static inline bool
+cpu_has(int feat)
+{
+	return (cpu_features[feat / 32] >> (feat % 32)) & 1;
+}
+
+void mp_init(void);
+void cpu_detect_features(void);
+void apply_alternatives(void);
+void cpu_init_percpu(void);
+void lapic_init(void);
+int lapic_cpunum(void);
+void lapic_startap(uint8_t apicid, uint32_t addr);
+void lapic_eoi(void);
+void lapic_ipi(int vector);
+
+#endif /* !JOS_KERN_CPU_H */
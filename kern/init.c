@@ -3,9 +3,17 @@
 #include <inc/stdio.h>
 #include <inc/string.h>
 #include <inc/assert.h>
+#include <inc/x86.h>
 
 #include <kern/monitor.h>
 #include <kern/console.h>
+#include <kern/bootinfo.h>
+#include <kern/pmap.h>
+#include <kern/slab.h>
+#include <kern/cpu.h>
+#include <kern/taskpool.h>
+
+static void boot_aps(void);
 
 // Test the stack backtrace function (lab 1 only)
 void
@@ -22,19 +30,40 @@ test_backtrace(int x)
 void
 i386_init(void)
 {
-	extern char edata[], end[];
+	// entry.S has already cleared the BSS section,
+	// so all static/global variables start out zero.
 
-	// Before doing anything else, complete the ELF loading process.
-	// Clear the uninitialized global data (BSS) section of our program.
-	// This ensures that all static/global variables start out zero.
-	memset(edata, 0, end - edata);
+	// Pick up what the boot loader left for us before anything
+	// can overwrite it.
+	bootinfo_init();
 
 	// Initialize the console.
 	// Can't call cprintf until after we do this!
 	cons_init();
+	boot_stamp(BOOTPH_CONS);
 
 	cprintf("6828 decimal is %o octal!\n", 6828);
 
+	// Per-CPU data, for the locks from here on; then specialize
+	// the kernel's hot paths to this CPU's features, before the
+	// rest of the kernel runs them.
+	cpu_detect_features();
+	cpu_init_percpu();
+	apply_alternatives();
+
+	// Lab 2 memory management initialization functions
+	mem_init();
+	kmem_init();
+
+	// Lab 4 multiprocessor initialization functions
+	mp_init();
+	lapic_init();
+	taskpool_init();
+
+	// Starting non-boot CPUs.  From here on, bulk initialization
+	// can fan out over all of them with task_parallel_for.
+	boot_aps();
+
 	// Test the stack backtrace function (lab 1 only)
 	test_backtrace(5);
 
@@ -44,6 +73,58 @@ i386_init(void)
 }
 
 
+// While boot_aps is booting a given CPU, it communicates the per-core
+// stack pointer that should be loaded by mpentry.S to that CPU in
+// this variable, and the boot CPU's CR4 in mpentry_cr4.
+void *mpentry_kstack;
+uint32_t mpentry_cr4;
+
+// Start the non-boot (AP) processors.
+static void
+boot_aps(void)
+{
+	extern unsigned char mpentry_start[], mpentry_end[];
+	void *code;
+	struct CpuInfo *c;
+
+	// Write entry code to unused memory at MPENTRY_PADDR
+	code = KADDR(MPENTRY_PADDR);
+	memmove(code, mpentry_start, mpentry_end - mpentry_start);
+	mpentry_cr4 = rcr4();
+
+	// Boot each AP one at a time
+	for (c = cpus; c < cpus + ncpu; c++) {
+		if (c == cpus + cpunum())  // We've started already.
+			continue;
+
+		// Tell mpentry.S what stack to use
+		mpentry_kstack = percpu_kstacks[c - cpus] + KSTKSIZE;
+		// Start the CPU at mpentry_start
+		lapic_startap(c->cpu_apicid, PADDR(code));
+		// Wait for the CPU to finish some basic setup in mp_main()
+		while(c->cpu_status != CPU_STARTED)
+			;
+	}
+}
+
+// Setup code for APs
+void
+mp_main(void)
+{
+	// We are in high EIP now, safe to switch to kern_pgdir
+	lcr3(PADDR(kern_pgdir));
+	lcr4(mpentry_cr4);
+
+	cpu_init_percpu();
+	lapic_init();
+	cprintf("SMP: CPU %d starting\n", cpunum());
+	xchg(&thiscpu->cpu_status, CPU_STARTED); // tell boot_aps() we're up
+
+	// Until there is a scheduler, APs help with the kernel's
+	// parallel jobs.
+	taskpool_worker();
+}
+
 /*
  * Variable panicstr contains argument to first call to panic; used as flag
  * to indicate that the kernel has already called panic.
@@ -10,6 +10,11 @@
 #include <kern/console.h>
 #include <kern/monitor.h>
 #include <kern/kdebug.h>
+#include <kern/bootinfo.h>
+#include <kern/tsc.h>
+#include <kern/pmap.h>
+#include <kern/slab.h>
+#include <kern/spinlock.h>
 
 #define CMDBUF_SIZE	80	// enough for one VGA text line
 
@@ -24,8 +29,15 @@ struct Command {
 static struct Command commands[] = {
 	{ "help", "Display this list of commands", mon_help },
 	{ "kerninfo", "Display information about the kernel", mon_kerninfo },
+	{ "boottime", "Display the time spent in each boot phase", mon_boottime },
+	{ "bench", "Run a micro-benchmark ('bench' lists them)", mon_bench },
+	{ "pages", "Display free physical pages by block order", mon_pages },
+	{ "slabs", "Display slab cache usage and hit rates", mon_slabs },
+	{ "locks", "Display the most contended spinlocks", mon_locks },
 };
 
+static void mon_memmap(void);
+
 /***** Implementations of basic kernel monitor commands *****/
 
 int
@@ -51,6 +63,105 @@ mon_kerninfo(int argc, char **argv, struct Trapframe *tf)
 	cprintf("  end    %08x (virt)  %08x (phys)\n", end, end - KERNBASE);
 	cprintf("Kernel executable memory footprint: %dKB\n",
 		ROUNDUP(end - entry, 1024) / 1024);
+	mon_memmap();
+	return 0;
+}
+
+// Print the physical memory map the boot loader passed in.
+static void
+mon_memmap(void)
+{
+	static const char * const types[] = {
+		[BOOTMEM_RAM]		= "RAM",
+		[BOOTMEM_RESERVED]	= "reserved",
+		[BOOTMEM_ACPI]		= "ACPI",
+		[BOOTMEM_NVS]		= "ACPI NVS",
+		[BOOTMEM_BAD]		= "unusable",
+	};
+	struct Bootmem *bm;
+	uint32_t t;
+
+	if (bootinfo.bi_nmem == 0) {
+		cprintf("No physical memory map from the boot loader\n");
+		return;
+	}
+	cprintf("Physical memory map:\n");
+	for (bm = bootinfo.bi_mem; bm < bootinfo.bi_mem + bootinfo.bi_nmem; bm++) {
+		t = bm->bm_type;
+		cprintf("  %016llx-%016llx %s\n", bm->bm_addr,
+			bm->bm_addr + bm->bm_len - 1,
+			t < ARRAY_SIZE(types) && types[t] ? types[t] : "?");
+	}
+}
+
+int
+mon_boottime(int argc, char **argv, struct Trapframe *tf)
+{
+	static const char * const names[NBOOTPH] = {
+		[BOOTPH_LOADER]	= "loader",
+		[BOOTPH_A20]	= "a20",
+		[BOOTPH_ENTRY]	= "entry",
+		[BOOTPH_BSS]	= "bss",
+		[BOOTPH_CONS]	= "cons",
+		[BOOTPH_PROMPT]	= "prompt",
+	};
+	uint64_t start, prev, t;
+	int i;
+
+	if (tsc_khz == 0)
+		tsc_calibrate();
+	cprintf("TSC: %u kHz\n", tsc_khz);
+	cprintf("phase     since start (cycles)        delta (cycles)   delta (us)\n");
+
+	start = prev = 0;
+	for (i = 0; i < NBOOTPH; i++) {
+		if ((t = bootinfo.bi_tsc[i]) == 0)
+			continue;
+		if (start == 0)
+			start = prev = t;
+		if (names[i])
+			cprintf("%-8s", names[i]);
+		else
+			cprintf("seg%d    ", i - BOOTPH_SEG);
+		cprintf(" %20llu  %20llu  %11llu\n",
+			t - start, t - prev, tsc_to_us(t - prev));
+		prev = t;
+	}
+	return 0;
+}
+
+int
+mon_pages(int argc, char **argv, struct Trapframe *tf)
+{
+	size_t n, total = 0;
+	int i;
+
+	cprintf("order  block size      free blocks\n");
+	for (i = 0; i < NPAGEORDER; i++) {
+		n = page_nfree(i);
+		total += n << i;
+		cprintf("%5d  %8uK  %15u\n", i, (PGSIZE << i) / 1024, n);
+	}
+	cprintf("%u of %u pages free\n", total, npages);
+	return 0;
+}
+
+int
+mon_slabs(int argc, char **argv, struct Trapframe *tf)
+{
+	kmem_print_stats();
+	return 0;
+}
+
+// Usage: locks [n]
+int
+mon_locks(int argc, char **argv, struct Trapframe *tf)
+{
+	long n = 10;
+
+	if (argc >= 2 && (n = strtol(argv[1], NULL, 0)) <= 0)
+		n = 10;
+	lock_print_stats(n);
 	return 0;
 }
 
@@ -116,6 +227,7 @@ monitor(struct Trapframe *tf)
 	cprintf("Type 'help' for a list of commands.\n");
 
 
+	boot_stamp(BOOTPH_PROMPT);
 	while (1) {
 		buf = readline("K> ");
 		if (buf != NULL)
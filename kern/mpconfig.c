@@ -0,0 +1,376 @@
+// Search for and parse the multiprocessor configuration table
+// See http://developer.intel.com/design/pentium/datashts/24201606.pdf
+// and the ACPI specification, section 5.2.12 (MADT).
+
+#include <inc/types.h>
+#include <inc/assert.h>
+#include <inc/stdio.h>
+#include <inc/string.h>
+#include <inc/memlayout.h>
+#include <inc/x86.h>
+#include <inc/mmu.h>
+#include <kern/cpu.h>
+#include <kern/pmap.h>
+
+struct CpuInfo cpus[NCPU];
+struct CpuInfo *bootcpu;
+int ismp;
+int ncpu;
+uint8_t cpu_by_apicid[256];
+
+// Per-CPU kernel stacks
+unsigned char percpu_kstacks[NCPU][KSTKSIZE]
+__attribute__ ((aligned(PGSIZE)));
+
+
+// See MultiProcessor Specification Version 1.[14]
+
+struct mp {             // floating pointer [MP 4.1]
+	uint8_t signature[4];           // "_MP_"
+	physaddr_t physaddr;            // phys addr of MP config table
+	uint8_t length;                 // 1
+	uint8_t specrev;                // [14]
+	uint8_t checksum;               // all bytes must add up to 0
+	uint8_t type;                   // MP system config type
+	uint8_t imcrp;
+	uint8_t reserved[3];
+} __attribute__((__packed__));
+
+struct mpconf {         // configuration table header [MP 4.2]
+	uint8_t signature[4];           // "PCMP"
+	uint16_t length;                // total table length
+	uint8_t version;                // [14]
+	uint8_t checksum;               // all bytes must add up to 0
+	uint8_t product[20];            // product id
+	physaddr_t oemtable;            // OEM table pointer
+	uint16_t oemlength;             // OEM table length
+	uint16_t entry;                 // entry count
+	physaddr_t lapicaddr;           // address of local APIC
+	uint16_t xlength;               // extended table length
+	uint8_t xchecksum;              // extended table checksum
+	uint8_t reserved;
+	uint8_t entries[0];             // table entries
+} __attribute__((__packed__));
+
+struct mpproc {         // processor table entry [MP 4.3.1]
+	uint8_t type;                   // entry type (0)
+	uint8_t apicid;                 // local APIC id
+	uint8_t version;                // local APIC version
+	uint8_t flags;                  // CPU flags
+	uint8_t signature[4];           // CPU signature
+	uint32_t feature;               // feature flags from CPUID instruction
+	uint8_t reserved[8];
+} __attribute__((__packed__));
+
+// mpproc flags
+#define MPPROC_BOOT 0x02                // This mpproc is the bootstrap processor
+
+// Table entry types
+#define MPPROC    0x00  // One per processor
+#define MPBUS     0x01  // One per bus
+#define MPIOAPIC  0x02  // One per I/O APIC
+#define MPIOINTR  0x03  // One per bus interrupt source
+#define MPLINTR   0x04  // One per system interrupt source
+
+// ACPI root system description pointer [ACPI 5.2.5]
+struct acpi_rsdp {
+	uint8_t signature[8];           // "RSD PTR "
+	uint8_t checksum;               // first 20 bytes must add up to 0
+	uint8_t oemid[6];
+	uint8_t revision;
+	physaddr_t rsdt;                // phys addr of RSDT
+} __attribute__((__packed__));
+
+// ACPI system description table header [ACPI 5.2.6]
+struct acpi_header {
+	uint8_t signature[4];
+	uint32_t length;                // total table length
+	uint8_t revision;
+	uint8_t checksum;               // all bytes must add up to 0
+	uint8_t oemid[6];
+	uint8_t oemtableid[8];
+	uint32_t oemrevision;
+	uint32_t creatorid;
+	uint32_t creatorrevision;
+} __attribute__((__packed__));
+
+struct acpi_madt {      // multiple APIC description table [ACPI 5.2.12]
+	struct acpi_header header;      // "APIC"
+	physaddr_t lapicaddr;           // address of local APIC
+	uint32_t flags;
+	uint8_t entries[0];             // interrupt controller structures
+} __attribute__((__packed__));
+
+struct acpi_madt_lapic {    // processor local APIC [ACPI 5.2.12.2]
+	uint8_t type;                   // MADT_LAPIC
+	uint8_t length;                 // 8
+	uint8_t procid;                 // ACPI processor id
+	uint8_t apicid;                 // local APIC id
+	uint32_t flags;                 // MADT_LAPIC_ENABLED
+} __attribute__((__packed__));
+
+#define MADT_LAPIC		0x00    // processor local APIC entry
+#define MADT_LAPIC_ENABLED	0x01    // processor is usable
+
+static uint8_t
+sum(void *addr, int len)
+{
+	int i, sum;
+
+	sum = 0;
+	for (i = 0; i < len; i++)
+		sum += ((uint8_t *)addr)[i];
+	return sum;
+}
+
+// Return the kernel address of 'len' bytes at physical address 'pa',
+// or NULL if the direct map does not cover them.
+static void *
+phys(physaddr_t pa, uint32_t len)
+{
+	if (pa + len < pa || pa + len > npages * PGSIZE)
+		return NULL;
+	return KADDR(pa);
+}
+
+// Look for an MP structure in the len bytes at physical address addr.
+static struct mp *
+mpsearch1(physaddr_t a, int len)
+{
+	struct mp *mp = KADDR(a), *end = KADDR(a + len);
+
+	for (; mp < end; mp++)
+		if (memcmp(mp->signature, "_MP_", 4) == 0 &&
+		    sum(mp, sizeof(*mp)) == 0)
+			return mp;
+	return NULL;
+}
+
+// Search for the MP Floating Pointer Structure, which according to
+// [MP 4] is in one of the following three locations:
+// 1) in the first KB of the EBDA;
+// 2) if there is no EBDA, in the last KB of system base memory;
+// 3) in the BIOS ROM between 0xE0000 and 0xFFFFF.
+static struct mp *
+mpsearch(void)
+{
+	uint8_t *bda;
+	uint32_t p;
+	struct mp *mp;
+
+	static_assert(sizeof(*mp) == 16);
+
+	// The BIOS data area lives in 16-bit segment 0x40.
+	bda = (uint8_t *) KADDR(0x40 << 4);
+
+	// [MP 4] The 16-bit segment of the EBDA is in the two bytes
+	// starting at byte 0x0E of the BDA.  0 if not present.
+	if ((p = *(uint16_t *) (bda + 0x0E))) {
+		p <<= 4;	// Translate from segment to PA
+		if ((mp = mpsearch1(p, 1024)))
+			return mp;
+	} else {
+		// The size of base memory, in KB is in the two bytes
+		// starting at 0x13 of the BDA.
+		p = *(uint16_t *) (bda + 0x13) * 1024;
+		if ((mp = mpsearch1(p - 1024, 1024)))
+			return mp;
+	}
+	return mpsearch1(0xF0000, 0x10000);
+}
+
+// Search for an MP configuration table.  For now, don't accept the
+// default configurations (physaddr == 0).
+// Check for the correct signature, checksum, and version.
+static struct mpconf *
+mpconfig(struct mp **pmp)
+{
+	struct mpconf *conf;
+	struct mp *mp;
+
+	if ((mp = mpsearch()) == 0)
+		return NULL;
+	if (mp->physaddr == 0 || mp->type != 0) {
+		cprintf("SMP: Default configurations not implemented\n");
+		return NULL;
+	}
+	if (!(conf = phys(mp->physaddr, sizeof(*conf)))
+	    || !phys(mp->physaddr, conf->length)) {
+		cprintf("SMP: MP configuration table out of reach\n");
+		return NULL;
+	}
+	if (memcmp(conf, "PCMP", 4) != 0) {
+		cprintf("SMP: Incorrect MP configuration table signature\n");
+		return NULL;
+	}
+	if (sum(conf, conf->length) != 0) {
+		cprintf("SMP: Bad MP configuration checksum\n");
+		return NULL;
+	}
+	if (conf->version != 1 && conf->version != 4) {
+		cprintf("SMP: Unsupported MP version %d\n", conf->version);
+		return NULL;
+	}
+	if ((sum((uint8_t *)conf + conf->length, conf->xlength) + conf->xchecksum) & 0xff) {
+		cprintf("SMP: Bad MP configuration extended checksum\n");
+		return NULL;
+	}
+	*pmp = mp;
+	return conf;
+}
+
+// Look for the ACPI RSDP in the len bytes at physical address a.
+// It is on a 16-byte boundary.
+static struct acpi_rsdp *
+rsdpsearch1(physaddr_t a, int len)
+{
+	uint8_t *p = KADDR(a), *end = KADDR(a + len);
+
+	for (; p < end; p += 16)
+		if (memcmp(p, "RSD PTR ", 8) == 0 &&
+		    sum(p, sizeof(struct acpi_rsdp)) == 0)
+			return (struct acpi_rsdp *) p;
+	return NULL;
+}
+
+// Find the MADT through the RSDP, which [ACPI 5.2.5.1] is in the
+// first KB of the EBDA or in the BIOS ROM between 0xE0000 and 0xFFFFF.
+static struct acpi_madt *
+madtsearch(void)
+{
+	struct acpi_rsdp *rsdp;
+	struct acpi_header *rsdt, *h;
+	physaddr_t *entry, ebda;
+	int i, n;
+
+	ebda = *(uint16_t *) KADDR(0x40E) << 4;
+	if (!(ebda && (rsdp = rsdpsearch1(ebda, 1024)))
+	    && !(rsdp = rsdpsearch1(0xE0000, 0x20000)))
+		return NULL;
+
+	if (!(rsdt = phys(rsdp->rsdt, sizeof(*rsdt)))
+	    || !phys(rsdp->rsdt, rsdt->length)
+	    || memcmp(rsdt->signature, "RSDT", 4) != 0
+	    || sum(rsdt, rsdt->length) != 0)
+		return NULL;
+
+	entry = (physaddr_t *) (rsdt + 1);
+	n = (rsdt->length - sizeof(*rsdt)) / sizeof(*entry);
+	for (i = 0; i < n; i++) {
+		if (!(h = phys(entry[i], sizeof(*h)))
+		    || memcmp(h->signature, "APIC", 4) != 0)
+			continue;
+		if (phys(entry[i], h->length) && sum(h, h->length) == 0)
+			return (struct acpi_madt *) h;
+	}
+	return NULL;
+}
+
+static void
+addcpu(uint8_t apicid)
+{
+	if (apicid == bootcpu->cpu_apicid)
+		return;		// already cpus[0]
+	if (ncpu < NCPU) {
+		cpus[ncpu].cpu_id = ncpu;
+		cpus[ncpu].cpu_apicid = apicid;
+		cpu_by_apicid[apicid] = ncpu;
+		ncpu++;
+	} else {
+		cprintf("SMP: too many CPUs, CPU %d disabled\n", apicid);
+	}
+}
+
+// Take the processors from the ACPI MADT.
+static bool
+madt_init(void)
+{
+	struct acpi_madt *madt;
+	struct acpi_madt_lapic *lp;
+	uint8_t *p, *end;
+
+	if (!(madt = madtsearch()))
+		return false;
+	lapicaddr = madt->lapicaddr;
+	end = (uint8_t *) madt + madt->header.length;
+	// Each entry starts with its type and length; stop at one that
+	// runs past the end of the table.
+	for (p = madt->entries;
+	     p + 2 <= end && p[1] >= 2 && p + p[1] <= end; p += p[1]) {
+		lp = (struct acpi_madt_lapic *) p;
+		if (lp->type == MADT_LAPIC && lp->length >= sizeof(*lp)
+		    && (lp->flags & MADT_LAPIC_ENABLED))
+			addcpu(lp->apicid);
+	}
+	return true;
+}
+
+// Take the processors from the MP configuration table.
+static bool
+mpconf_init(void)
+{
+	struct mp *mp;
+	struct mpconf *conf;
+	struct mpproc *proc;
+	uint8_t *p;
+	unsigned int i;
+
+	if ((conf = mpconfig(&mp)) == 0)
+		return false;
+	lapicaddr = conf->lapicaddr;
+
+	for (p = conf->entries, i = 0; i < conf->entry; i++) {
+		switch (*p) {
+		case MPPROC:
+			proc = (struct mpproc *)p;
+			addcpu(proc->apicid);
+			p += sizeof(struct mpproc);
+			continue;
+		case MPBUS:
+		case MPIOAPIC:
+		case MPIOINTR:
+		case MPLINTR:
+			p += 8;
+			continue;
+		default:
+			cprintf("mpinit: unknown config type %x\n", *p);
+			ncpu = 1;
+			return false;
+		}
+	}
+
+	if (mp->imcrp) {
+		// [MP 3.2.6.1] If the hardware implements PIC mode,
+		// switch to getting interrupts from the LAPIC.
+		cprintf("SMP: Setting IMCR to switch from PIC mode to symmetric I/O mode\n");
+		outb(0x22, 0x70);   // Select IMCR
+		outb(0x23, inb(0x23) | 1);  // Mask external interrupts.
+	}
+	return true;
+}
+
+// Find the CPUs, preferring the ACPI MADT over the older MP tables.
+// The boot CPU, the one running this, is always cpus[0], so that
+// cpu_init_percpu can set it up before anyone knows its APIC ID;
+// CPUID tells which table entry it is.
+void
+mp_init(void)
+{
+	uint32_t ebx;
+
+	cpuid(1, NULL, &ebx, NULL, NULL);
+	bootcpu = &cpus[0];
+	bootcpu->cpu_apicid = ebx >> 24;
+	bootcpu->cpu_status = CPU_STARTED;
+	ncpu = 1;
+
+	ismp = madt_init() || mpconf_init();
+	if (!ismp) {
+		// Didn't like what we found; fall back to no MP.
+		ncpu = 1;
+		lapicaddr = 0;
+		cprintf("SMP: configuration not found, SMP disabled\n");
+		return;
+	}
+	cprintf("SMP: CPU %d found %d CPU(s)\n", bootcpu->cpu_id, ncpu);
+}
@@ -0,0 +1,725 @@
+/* See COPYRIGHT for copyright information. */
+
+#include <inc/x86.h>
+#include <inc/mmu.h>
+#include <inc/error.h>
+#include <inc/string.h>
+#include <inc/assert.h>
+
+#include <kern/pmap.h>
+#include <kern/kclock.h>
+#include <kern/bootinfo.h>
+#include <kern/cpu.h>
+#include <kern/spinlock.h>
+#include <kern/taskpool.h>
+
+// These variables are set by i386_detect_memory()
+size_t npages;			// Amount of physical memory (in pages)
+
+// These variables are set in mem_init()
+pde_t *kern_pgdir;		// Kernel's initial page directory
+struct PageInfo *pages;		// Physical page state array
+
+// Free blocks of 2^order pages, one list per order.
+static struct FreeArea {
+	struct PageInfo *fa_head;
+	size_t fa_nfree;		// number of blocks on the list
+} free_area[NPAGEORDER];
+static struct spinlock page_lock;	// protects free_area and PP_FREE
+
+static void mem_init_mp(uint32_t perm);
+static void boot_map_region(pde_t *pgdir, uintptr_t va, size_t size, physaddr_t pa, int perm);
+static void check_page_alloc(void);
+static void check_kern_pgdir(void);
+
+// --------------------------------------------------------------
+// Detect machine's physical memory setup.
+// --------------------------------------------------------------
+
+static int
+nvram_read(int r)
+{
+	return mc146818_read(r) | (mc146818_read(r + 1) << 8);
+}
+
+// Use the memory map from the boot loader, or make one up from the
+// sizes in the NVRAM if there is none.  npages covers the highest
+// RAM or ACPI table address that fits in the KERNBASE window, so that
+// mp_init can read the ACPI tables, which often sit just above RAM.
+static void
+i386_detect_memory(void)
+{
+	size_t basemem, extmem, ext16mem;
+	struct Bootmem *bm;
+	uint64_t top;
+
+	if (bootinfo.bi_nmem == 0) {
+		// Use CMOS calls to measure available base & extended memory.
+		// (CMOS calls return results in kilobytes.)
+		basemem = nvram_read(NVRAM_BASELO);
+		extmem = nvram_read(NVRAM_EXTLO);
+		ext16mem = nvram_read(NVRAM_EXT16LO) * 64;
+
+		// Extended memory above 16MB is reported in 64KB units.
+		if (ext16mem)
+			extmem = 16 * 1024 + ext16mem - 1024;
+		bootinfo_add_mem(0, basemem * 1024, BOOTMEM_RAM);
+		bootinfo_add_mem(EXTPHYSMEM, extmem * 1024, BOOTMEM_RAM);
+	}
+
+	top = 0;
+	for (bm = bootinfo.bi_mem; bm < bootinfo.bi_mem + bootinfo.bi_nmem; bm++)
+		if (bm->bm_type == BOOTMEM_RAM || bm->bm_type == BOOTMEM_ACPI
+		    || bm->bm_type == BOOTMEM_NVS)
+			top = MAX(top, bm->bm_addr + bm->bm_len);
+	top = MIN(top, 0x100000000ULL - KERNBASE);
+	npages = top / PGSIZE;
+
+	cprintf("Physical memory: %uK available, %d map entries\n",
+		npages * (PGSIZE / 1024), bootinfo.bi_nmem);
+}
+
+// Is the physical page at 'pa' RAM according to the memory map?
+// Any overlapping entry that is not RAM wins.
+static bool
+page_is_ram(physaddr_t pa)
+{
+	uint64_t lo = pa, hi = lo + PGSIZE;
+	struct Bootmem *bm;
+	bool ram = false;
+
+	for (bm = bootinfo.bi_mem; bm < bootinfo.bi_mem + bootinfo.bi_nmem; bm++) {
+		if (bm->bm_addr >= hi || bm->bm_addr + bm->bm_len <= lo)
+			continue;
+		if (bm->bm_type != BOOTMEM_RAM)
+			return false;
+		if (bm->bm_addr <= lo && bm->bm_addr + bm->bm_len >= hi)
+			ram = true;
+	}
+	return ram;
+}
+
+
+// --------------------------------------------------------------
+// Set up memory mappings above UTOP.
+// --------------------------------------------------------------
+
+// This simple physical memory allocator is used only while JOS is setting
+// up its virtual memory system.  page_alloc() is the real allocator.
+//
+// If n>0, allocates enough pages of contiguous physical memory to hold 'n'
+// bytes.  Doesn't initialize the memory.  Returns a kernel virtual address.
+//
+// If n==0, returns the address of the next free page without allocating
+// anything.
+//
+// It only hands out memory that entry_pgdir maps, that is, up to the
+// end of the kernel rounded up to 4MB.
+static void *
+boot_alloc(uint32_t n)
+{
+	static char *nextfree;	// virtual address of next byte of free memory
+	extern char end[];
+	char *result;
+
+	// Initialize nextfree if this is the first time.
+	// 'end' is a magic symbol automatically generated by the linker,
+	// which points to the end of the kernel's bss segment:
+	// the first virtual address that the linker did *not* assign
+	// to any kernel code or global variables.
+	if (!nextfree)
+		nextfree = ROUNDUP((char *) end, PGSIZE);
+
+	result = nextfree;
+	nextfree = ROUNDUP(nextfree + n, PGSIZE);
+	if (PADDR(nextfree) > ROUNDUP(PADDR(end), PTSIZE))
+		panic("boot_alloc: out of memory for %u bytes", n);
+	return result;
+}
+
+// Set up a two-level page table:
+//    kern_pgdir is its linear (virtual) address of the root
+//
+// This function only sets up the kernel part of the address space
+// (ie. addresses >= UTOP).  The user part of the address space
+// will be set up later.
+//
+// From UTOP to ULIM, the user is allowed to read but not write.
+// Above ULIM the user cannot read or write.
+void
+mem_init(void)
+{
+	uint32_t perm;
+
+	// Find out how much memory the machine has (npages).
+	i386_detect_memory();
+
+	//////////////////////////////////////////////////////////////////////
+	// create initial page directory.
+	kern_pgdir = (pde_t *) boot_alloc(PGSIZE);
+	memset(kern_pgdir, 0, PGSIZE);
+
+	//////////////////////////////////////////////////////////////////////
+	// Allocate an array of npages 'struct PageInfo's and store it in
+	// 'pages'.  The kernel uses this array to keep track of physical
+	// pages: for each physical page, there is a corresponding struct
+	// PageInfo in this array.
+	pages = boot_alloc(npages * sizeof(struct PageInfo));
+	memset(pages, 0, npages * sizeof(struct PageInfo));
+
+	//////////////////////////////////////////////////////////////////////
+	// Map all of physical memory at KERNBASE.
+	// Ie.  the VA range [KERNBASE, KERNBASE + npages * PGSIZE) should map
+	//      to the PA range [0, npages * PGSIZE).  npages never goes past
+	//      the 256MB that fit, see i386_detect_memory.
+	// Permissions: kernel RW, user NONE; global if entry.S turned on
+	// global pages.  Any page tables this needs come from boot_alloc,
+	// so do this before page_init.
+	perm = PTE_W;
+	if (rcr4() & CR4_PGE)
+		perm |= PTE_G;
+	boot_map_region(kern_pgdir, KERNBASE, npages * PGSIZE, 0, perm);
+
+	// Initialize the SMP-related parts of the memory map
+	mem_init_mp(perm);
+
+	//////////////////////////////////////////////////////////////////////
+	// Now that we've allocated the initial kernel data structures, we set
+	// up the list of free physical pages.  Once we've done so, all further
+	// memory management will go through the page_* functions.
+	page_init();
+
+	check_page_alloc();
+
+	// Switch from the minimal entry page directory to the full kern_pgdir
+	// page table we just created.	Our instruction pointer should be
+	// somewhere between KERNBASE and KERNBASE+4MB right now, which is
+	// mapped the same way by both page tables.
+	//
+	// If the machine reboots at this point, you've probably set up your
+	// kern_pgdir wrong.
+	lcr3(PADDR(kern_pgdir));
+	// entry.S's global mappings outlive the CR3 load; drop them so
+	// that the TLB only holds kern_pgdir's.
+	tlbflush_global();
+
+	check_kern_pgdir();
+}
+
+// Modify mappings in kern_pgdir to support SMP
+//   - Map the per-CPU stacks in the region [KSTACKTOP-PTSIZE, KSTACKTOP)
+//
+static void
+mem_init_mp(uint32_t perm)
+{
+	// Map per-CPU stacks starting at KSTACKTOP, for up to 'NCPU' CPUs.
+	//
+	// For CPU i, use the physical memory that 'percpu_kstacks[i]' refers
+	// to as its kernel stack. CPU i's kernel stack grows down from virtual
+	// address kstacktop_i = KSTACKTOP - i * (KSTKSIZE + KSTKGAP), and is
+	// divided into two pieces:
+	//     * [kstacktop_i - KSTKSIZE, kstacktop_i)
+	//          -- backed by physical memory
+	//     * [kstacktop_i - (KSTKSIZE + KSTKGAP), kstacktop_i - KSTKSIZE)
+	//          -- not backed; so if the kernel overflows its stack,
+	//             it will fault rather than overwrite another CPU's stack.
+	//             Known as a "guard page".
+	//     Permissions: 'perm', kernel RW, user NONE.  The page table
+	//     comes from boot_alloc, so this runs before page_init.
+	int i;
+
+	for (i = 0; i < NCPU; i++)
+		boot_map_region(kern_pgdir,
+				KSTACKTOP - i * (KSTKSIZE + KSTKGAP) - KSTKSIZE,
+				KSTKSIZE, PADDR(percpu_kstacks[i]), perm);
+}
+
+//
+// Map [va, va+size) of virtual address space to physical [pa, pa+size)
+// in the page table rooted at pgdir.  Size is a multiple of PGSIZE, and
+// va and pa are both page-aligned.
+// Use permission bits perm|PTE_P for the entries.
+//
+// Wherever va and pa are both 4MB-aligned with at least 4MB to go,
+// this uses one large (PTE_PS) page directory entry instead of a page
+// table.  entry.S has already turned on PSE, or halted without it.
+// The page tables it does need come from boot_alloc, so this is only
+// meant for the static mappings above UTOP set up in mem_init.
+//
+static void
+boot_map_region(pde_t *pgdir, uintptr_t va, size_t size, physaddr_t pa, int perm)
+{
+	pde_t *pde;
+	pte_t *pt;
+	size_t off;
+
+	for (off = 0; off < size; ) {
+		pde = &pgdir[PDX(va + off)];
+		if ((va + off) % PTSIZE == 0 && (pa + off) % PTSIZE == 0
+		    && size - off >= PTSIZE) {
+			*pde = (pa + off) | perm | PTE_P | PTE_PS;
+			off += PTSIZE;
+			continue;
+		}
+		if (!(*pde & PTE_P)) {
+			pt = boot_alloc(PGSIZE);
+			memset(pt, 0, PGSIZE);
+			*pde = PADDR(pt) | PTE_P | PTE_W | PTE_U;
+		}
+		pt = KADDR(PTE_ADDR(*pde));
+		pt[PTX(va + off)] = (pa + off) | perm | PTE_P;
+		off += PGSIZE;
+	}
+}
+
+// --------------------------------------------------------------
+// Tracking of physical pages.
+// The 'pages' array has one 'struct PageInfo' entry per physical page.
+// Free pages are kept by a buddy allocator: a free block of 2^order
+// pages starts at a page number that is a multiple of 2^order, and
+// its buddy is the block it was split from's other half, at page
+// number pfn ^ (1 << order).  Freeing a block merges it with its
+// buddy, and so on up, while the buddy is free and whole.
+// --------------------------------------------------------------
+
+static void
+freelist_add(struct PageInfo *pp, int order)
+{
+	struct FreeArea *fa = &free_area[order];
+
+	pp->pp_order = order;
+	pp->pp_flags |= PP_FREE;
+	pp->pp_prev = NULL;
+	pp->pp_link = fa->fa_head;
+	if (fa->fa_head)
+		fa->fa_head->pp_prev = pp;
+	fa->fa_head = pp;
+	fa->fa_nfree++;
+}
+
+static void
+freelist_remove(struct PageInfo *pp, int order)
+{
+	struct FreeArea *fa = &free_area[order];
+
+	if (pp->pp_prev)
+		pp->pp_prev->pp_link = pp->pp_link;
+	else
+		fa->fa_head = pp->pp_link;
+	if (pp->pp_link)
+		pp->pp_link->pp_prev = pp->pp_prev;
+	pp->pp_link = pp->pp_prev = NULL;
+	pp->pp_flags &= ~PP_FREE;
+	fa->fa_nfree--;
+}
+
+//
+// Hand every free physical page to the buddy allocator.  Not free:
+//  1) Physical page 0, which holds the real-mode IDT and BIOS
+//     structures in case we ever need them.
+//  2) Anything the memory map does not call RAM, which includes the
+//     IO hole [IOPHYSMEM, EXTPHYSMEM).
+//  3) The kernel and what boot_alloc has handed out, from EXTPHYSMEM
+//     up to boot_alloc(0).
+//  4) The page at MPENTRY_PADDR, where boot_aps copies the AP
+//     start-up code.
+// The boot info page is free again: bootinfo_init() copied it.
+//
+void
+page_init(void)
+{
+	physaddr_t kern_end = PADDR(boot_alloc(0));
+	size_t i;
+
+	spin_initlock(page_lock);
+	for (i = 1; i < npages; i++) {
+		if (i >= PGNUM(EXTPHYSMEM) && i < PGNUM(kern_end))
+			continue;
+		if (i == PGNUM(MPENTRY_PADDR))
+			continue;
+		if (page_is_ram(i * PGSIZE))
+			page_free(&pages[i]);
+	}
+}
+
+// --------------------------------------------------------------
+// Page contents
+// --------------------------------------------------------------
+
+// With SSE2, clear_page and copy_page store with movntdq, which
+// writes whole lines straight to memory instead of pulling each line
+// into the cache, and evicting something else, just to overwrite it.
+// The sfence orders those weakly-ordered stores before any later
+// store, such as one publishing the page to another CPU.  Without
+// SSE2, they are rep stosl and rep movsl.  The caller must not care
+// that the page is not in the cache afterwards.
+
+static void __attribute__((target("sse2")))
+clear_page_sse2(void *va)
+{
+	int n = PGSIZE / 64;
+
+	asm volatile("pxor %%xmm0, %%xmm0\n"
+		     "1:\n\t"
+		     "movntdq %%xmm0, (%0)\n\t"
+		     "movntdq %%xmm0, 16(%0)\n\t"
+		     "movntdq %%xmm0, 32(%0)\n\t"
+		     "movntdq %%xmm0, 48(%0)\n\t"
+		     "add $64, %0\n\t"
+		     "dec %1\n\t"
+		     "jnz 1b\n\t"
+		     "sfence"
+		     : "+r" (va), "+r" (n) : : "cc", "memory", "xmm0");
+}
+
+static void __attribute__((target("sse2")))
+copy_page_sse2(void *dst, const void *src)
+{
+	int n = PGSIZE / 64;
+
+	asm volatile("1:\n\t"
+		     "movdqa (%1), %%xmm0\n\t"
+		     "movdqa 16(%1), %%xmm1\n\t"
+		     "movdqa 32(%1), %%xmm2\n\t"
+		     "movdqa 48(%1), %%xmm3\n\t"
+		     "movntdq %%xmm0, (%0)\n\t"
+		     "movntdq %%xmm1, 16(%0)\n\t"
+		     "movntdq %%xmm2, 32(%0)\n\t"
+		     "movntdq %%xmm3, 48(%0)\n\t"
+		     "add $64, %1\n\t"
+		     "add $64, %0\n\t"
+		     "dec %2\n\t"
+		     "jnz 1b\n\t"
+		     "sfence"
+		     : "+r" (dst), "+r" (src), "+r" (n)
+		     : : "cc", "memory", "xmm0", "xmm1", "xmm2", "xmm3");
+}
+
+void
+clear_page(void *va)
+{
+	int n = PGSIZE / 4;
+
+	assert(PGOFF(va) == 0);
+	if (static_cpu_has(FEAT_SSE2))
+		clear_page_sse2(va);
+	else
+		asm volatile("cld; rep stosl"
+			     : "+D" (va), "+c" (n) : "a" (0) : "cc", "memory");
+}
+
+void
+copy_page(void *dst, const void *src)
+{
+	int n = PGSIZE / 4;
+
+	assert(PGOFF(dst) == 0 && PGOFF(src) == 0);
+	if (static_cpu_has(FEAT_SSE2))
+		copy_page_sse2(dst, src);
+	else
+		asm volatile("cld; rep movsl"
+			     : "+D" (dst), "+S" (src), "+c" (n)
+			     : : "cc", "memory");
+}
+
+// Blocks at least this many pages are zeroed by all CPUs together,
+// and bypassing the caches: few of their pages will be used soon.
+#define PZERO_PARALLEL	256
+#define PZERO_GRAIN	16
+
+static void
+page_zero_range(void *arg, uint32_t lo, uint32_t hi)
+{
+	struct PageInfo *pp = arg;
+
+	for (; lo < hi; lo++)
+		clear_page(page2kva(pp + lo));
+}
+
+// Zero 'n' contiguous pages starting at 'pp'.
+static void
+page_zero(struct PageInfo *pp, uint32_t n)
+{
+	if (n >= PZERO_PARALLEL)
+		task_parallel_for(0, n, PZERO_GRAIN, page_zero_range, pp);
+	else
+		memset(page2kva(pp), 0, n * PGSIZE);
+}
+
+//
+// Allocates a block of 2^order physical pages.  If (alloc_flags &
+// ALLOC_ZERO), fills the block with '\0' bytes.  Splits the smallest
+// free block that is large enough, putting the halves it does not
+// use back on the free lists.
+//
+// A large block is zeroed by all CPUs, through the task pool, so
+// don't ask for a zeroed one while holding a spinlock.
+//
+// Does NOT increment the reference count of the page - the caller must
+// do these if necessary (either explicitly or via page_insert).
+//
+// Returns NULL if out of free memory.
+//
+struct PageInfo *
+page_alloc_order(int order, int alloc_flags)
+{
+	struct PageInfo *pp;
+	int o;
+
+	assert(order >= 0 && order < NPAGEORDER);
+	spin_lock(&page_lock);
+	for (o = order; o < NPAGEORDER && !free_area[o].fa_head; o++)
+		/* do nothing */;
+	if (o == NPAGEORDER) {
+		spin_unlock(&page_lock);
+		return NULL;
+	}
+
+	pp = free_area[o].fa_head;
+	freelist_remove(pp, o);
+	while (o > order) {
+		o--;
+		freelist_add(pp + (1 << o), o);
+	}
+	pp->pp_order = order;
+	spin_unlock(&page_lock);
+
+	if (alloc_flags & ALLOC_ZERO)
+		page_zero(pp, 1 << order);
+	return pp;
+}
+
+// Allocates a single physical page; see page_alloc_order.
+struct PageInfo *
+page_alloc(int alloc_flags)
+{
+	return page_alloc_order(0, alloc_flags);
+}
+
+//
+// Return a block of 2^order pages to the free lists,
+// merging it with its buddies.
+// (This function should only be called when pp->pp_ref reaches 0.)
+//
+void
+page_free_order(struct PageInfo *pp, int order)
+{
+	size_t pfn = pp - pages, bpfn;
+	struct PageInfo *buddy;
+
+	assert(order >= 0 && order < NPAGEORDER);
+	assert((pfn & ((1 << order) - 1)) == 0);
+	spin_lock(&page_lock);
+	if (pp->pp_ref != 0 || (pp->pp_flags & PP_FREE))
+		panic("page_free: page %08x is in use or already free",
+		      page2pa(pp));
+
+	for (; order < NPAGEORDER - 1; order++) {
+		bpfn = pfn ^ (1 << order);
+		if (bpfn + (1 << order) > npages)
+			break;
+		buddy = &pages[bpfn];
+		if (!(buddy->pp_flags & PP_FREE) || buddy->pp_order != order)
+			break;
+		freelist_remove(buddy, order);
+		pfn &= ~(1 << order);
+	}
+	freelist_add(&pages[pfn], order);
+	spin_unlock(&page_lock);
+}
+
+// Return a single page to the free lists.
+void
+page_free(struct PageInfo *pp)
+{
+	page_free_order(pp, 0);
+}
+
+//
+// Decrement the reference count on a page,
+// freeing it if there are no more refs.
+//
+void
+page_decref(struct PageInfo* pp)
+{
+	if (--pp->pp_ref == 0)
+		page_free_order(pp, pp->pp_order);
+}
+
+// Given 'pgdir', a pointer to a page directory, pgdir_walk returns
+// a pointer to the page table entry (PTE) for linear address 'va'.
+// This requires walking the two-level page table structure.
+//
+// If the relevant page table doesn't exist and 'create' is true, a new
+// page table page is allocated with page_alloc.  Otherwise, or if the
+// allocation fails, pgdir_walk returns NULL.  It must not be used on a
+// large page (PTE_PS) mapping.
+//
+pte_t *
+pgdir_walk(pde_t *pgdir, const void *va, int create)
+{
+	pde_t *pde = &pgdir[PDX(va)];
+	struct PageInfo *pp;
+
+	assert(!(*pde & PTE_PS));
+	if (!(*pde & PTE_P)) {
+		if (!create || !(pp = page_alloc(ALLOC_ZERO)))
+			return NULL;
+		pp->pp_ref++;
+		*pde = page2pa(pp) | PTE_P | PTE_W | PTE_U;
+	}
+	return (pte_t *) KADDR(PTE_ADDR(*pde)) + PTX(va);
+}
+
+//
+// Reserve size bytes in the MMIO region and map [pa,pa+size) at this
+// location.  Return the base of the reserved region.  size does *not*
+// have to be multiple of PGSIZE.
+//
+void *
+mmio_map_region(physaddr_t pa, size_t size)
+{
+	// Where to start the next region.  Initially, this is the
+	// beginning of the MMIO region.  Because this is static, its
+	// value will be preserved between calls to mmio_map_region
+	// (just like nextfree in boot_alloc).
+	static uintptr_t base = MMIOBASE;
+	uintptr_t va = base;
+	size_t off;
+	pte_t *pte;
+
+	// Device memory is uncached (PTE_PCD) and written through
+	// (PTE_PWT), so reads and writes go straight to the device.
+	size = ROUNDUP(size + PGOFF(pa), PGSIZE);
+	pa = ROUNDDOWN(pa, PGSIZE);
+	if (base + size > MMIOLIM || base + size < base)
+		panic("mmio_map_region: out of MMIO space for %u bytes", size);
+	for (off = 0; off < size; off += PGSIZE) {
+		if (!(pte = pgdir_walk(kern_pgdir, (void *) (va + off), 1)))
+			panic("mmio_map_region: out of memory");
+		*pte = (pa + off) | PTE_PCD | PTE_PWT | PTE_W | PTE_P;
+	}
+	base += size;
+	return (void *) va;
+}
+
+// Number of free blocks of 2^order pages.
+size_t
+page_nfree(int order)
+{
+	assert(order >= 0 && order < NPAGEORDER);
+	return free_area[order].fa_nfree;
+}
+
+
+// --------------------------------------------------------------
+// Checking functions.
+// --------------------------------------------------------------
+
+//
+// Check the buddy allocator: blocks are aligned to their size and
+// don't overlap, buddies merge back, and freeing everything restores
+// the free lists exactly.
+//
+static void
+check_page_alloc(void)
+{
+	struct PageInfo *pp[NPAGEORDER], *pp0, *pp1;
+	size_t nfree[NPAGEORDER], total, n;
+	int i, j;
+
+	if (!pages)
+		panic("'pages' is a null pointer!");
+
+	total = 0;
+	for (i = 0; i < NPAGEORDER; i++) {
+		nfree[i] = free_area[i].fa_nfree;
+		total += nfree[i] << i;
+	}
+	assert(total > 0);
+
+	// one block of each order, where memory allows
+	for (i = 0; i < NPAGEORDER; i++) {
+		if ((pp[i] = page_alloc_order(i, 0)) == NULL)
+			continue;
+		assert((PGNUM(page2pa(pp[i])) & ((1 << i) - 1)) == 0);
+		assert(!(pp[i]->pp_flags & PP_FREE));
+		for (j = 0; j < i; j++)
+			assert(!pp[j] || pp[j] + (1 << j) <= pp[i]
+			       || pp[i] + (1 << i) <= pp[j]);
+	}
+
+	// the halves of a split block are buddies and merge when freed
+	assert((pp0 = page_alloc_order(1, 0)));
+	pp1 = pp0 + 1;
+	n = page_nfree(0);
+	page_free(pp0);
+	assert(page_nfree(0) == n + 1 && (pp0->pp_flags & PP_FREE));
+	page_free(pp1);
+	assert(page_nfree(0) == n && !(pp1->pp_flags & PP_FREE));
+	assert((pp0->pp_flags & PP_FREE) && pp0->pp_order >= 1);
+
+	for (i = NPAGEORDER - 1; i >= 0; i--)
+		if (pp[i])
+			page_free_order(pp[i], i);
+	for (i = 0; i < NPAGEORDER; i++)
+		assert(free_area[i].fa_nfree == nfree[i]);
+
+	cprintf("check_page_alloc() succeeded!\n");
+}
+
+// This function returns the physical address of the page containing 'va',
+// defined by the page directory 'pgdir'.  The hardware normally performs
+// this functionality for us!  We define our own version to help check
+// the check_kern_pgdir() function; it shouldn't be used elsewhere.
+
+static physaddr_t
+check_va2pa(pde_t *pgdir, uintptr_t va)
+{
+	pte_t *p;
+
+	pgdir = &pgdir[PDX(va)];
+	if (!(*pgdir & PTE_P))
+		return ~0;
+	if (*pgdir & PTE_PS)
+		return (*pgdir & ~(PTSIZE - 1)) | (va & (PTSIZE - 1) & ~0xFFF);
+	p = (pte_t*) KADDR(PTE_ADDR(*pgdir));
+	if (!(p[PTX(va)] & PTE_P))
+		return ~0;
+	return PTE_ADDR(p[PTX(va)]);
+}
+
+//
+// Checks that the kernel part of virtual address space
+// has been set up roughly correctly (by mem_init()).
+//
+static void
+check_kern_pgdir(void)
+{
+	pde_t *pgdir = kern_pgdir;
+	uint32_t i, n;
+
+	// check phys mem
+	for (i = 0; i < npages * PGSIZE; i += PGSIZE)
+		assert(check_va2pa(pgdir, KERNBASE + i) == i);
+
+	// every whole 4MB of it with a single large page
+	for (i = 0; i + PTSIZE <= npages * PGSIZE; i += PTSIZE)
+		assert(pgdir[PDX(KERNBASE + i)] & PTE_PS);
+
+	// check per-CPU kernel stacks and their guards
+	for (n = 0; n < NCPU; n++) {
+		uint32_t base = KSTACKTOP - (KSTKSIZE + KSTKGAP) * (n + 1);
+		for (i = 0; i < KSTKSIZE; i += PGSIZE)
+			assert(check_va2pa(pgdir, base + KSTKGAP + i)
+				== PADDR(percpu_kstacks[n]) + i);
+		for (i = 0; i < KSTKGAP; i += PGSIZE)
+			assert(check_va2pa(pgdir, base + i) == ~0);
+	}
+
+	// nothing else below KERNBASE yet
+	for (i = 0; i < PDX(KERNBASE); i++)
+		assert(i == PDX(KSTACKTOP-1) || pgdir[i] == 0);
+
+	cprintf("check_kern_pgdir() succeeded!\n");
+}
@@ -0,0 +1,382 @@
+// Slab allocator for fixed-size kernel objects, and kmalloc on top.
+//
+// Each slab is one page from the page allocator: a struct Slab header,
+// then the objects.  The header's s_link array chains the free objects
+// by index, so free objects keep their constructed contents.  An
+// allocation takes the most recently freed object of the slab that was
+// most recently freed into, so objects are reused while still in the
+// cache.
+//
+// A cache keeps its slabs on two lists, slabs with free objects and
+// full slabs.  At most one slab stays empty; any other slab that
+// empties goes back to the page allocator.  Each cache has a lock of
+// its own, which it holds while taking pages from the page allocator.
+
+#include <inc/assert.h>
+#include <inc/mmu.h>
+#include <inc/stdio.h>
+#include <inc/string.h>
+
+#include <kern/pmap.h>
+#include <kern/slab.h>
+#include <kern/spinlock.h>
+
+#define SLAB_NONE	0xFFFF	// end of a slab's free list
+
+struct Slab {
+	struct Slab *s_next;		// on kc_partial or kc_full
+	struct Slab **s_pprev;
+	struct Kmem_cache *s_cache;
+	uint8_t *s_mem;			// first object
+	uint16_t s_inuse;		// objects allocated
+	uint16_t s_free;		// first free object, or SLAB_NONE
+	uint16_t s_link[];		// next free object after each free object
+};
+
+struct Kmem_cache {
+	const char *kc_name;
+	size_t kc_size;			// object size, a multiple of kc_align
+	size_t kc_align;
+	void (*kc_ctor)(void *);
+	uint32_t kc_perslab;		// objects per slab
+	uint32_t kc_offset;		// of the first object in a slab
+	struct Slab *kc_partial;	// slabs with free objects
+	struct Slab *kc_full;		// slabs without
+	uint32_t kc_nempty;		// empty slabs on kc_partial, 0 or 1
+	struct Kmem_cache *kc_next;	// on kmem_caches
+	struct spinlock kc_lock;	// protects the slabs and statistics
+
+	// Statistics
+	uint32_t kc_nslabs;		// slabs allocated
+	uint32_t kc_inuse;		// objects allocated
+	uint32_t kc_hits;		// allocations from an existing slab
+	uint32_t kc_misses;		// allocations that needed a new slab
+	uint32_t kc_frees;		// objects freed
+};
+
+// kmalloc sizes are powers of two from KMALLOC_MIN to KMEM_MAXOBJ.
+#define KMALLOC_MIN	32
+#define KMALLOC_NCLASS	6
+
+static struct Kmem_cache cache_cache;		// holds the other caches
+static struct Kmem_cache *kmem_caches;		// all caches
+static struct spinlock kmem_caches_lock;	// protects kmem_caches
+static struct Kmem_cache *kmalloc_caches[KMALLOC_NCLASS];
+
+static void check_kmem(void);
+
+static void
+slab_insert(struct Slab **head, struct Slab *s)
+{
+	if ((s->s_next = *head) != NULL)
+		(*head)->s_pprev = &s->s_next;
+	s->s_pprev = head;
+	*head = s;
+}
+
+static void
+slab_remove(struct Slab *s)
+{
+	if (s->s_next)
+		s->s_next->s_pprev = s->s_pprev;
+	*s->s_pprev = s->s_next;
+}
+
+static void
+cache_init(struct Kmem_cache *kc, const char *name, size_t size,
+	   size_t align, void (*ctor)(void *))
+{
+	uint32_t n;
+
+	if (align == 0)
+		for (align = sizeof(void *); align < size && align < CACHELINE;
+		     align <<= 1)
+			/* do nothing */;
+	size = ROUNDUP(size, align);
+	if (size == 0 || size > KMEM_MAXOBJ || (align & (align - 1)) != 0)
+		panic("kmem_cache_create: %s: bad size %u or alignment %u",
+		      name, size, align);
+
+	memset(kc, 0, sizeof(*kc));
+	kc->kc_name = name;
+	kc->kc_size = size;
+	kc->kc_align = align;
+	kc->kc_ctor = ctor;
+
+	// As many objects as fit behind the header and its s_link array.
+	n = (PGSIZE - sizeof(struct Slab)) / (size + sizeof(uint16_t));
+	while (ROUNDUP(sizeof(struct Slab) + n * sizeof(uint16_t), align)
+	       + n * size > PGSIZE)
+		n--;
+	kc->kc_perslab = n;
+	kc->kc_offset = ROUNDUP(sizeof(struct Slab) + n * sizeof(uint16_t),
+				align);
+	__spin_initlock(&kc->kc_lock, name);
+
+	spin_lock(&kmem_caches_lock);
+	kc->kc_next = kmem_caches;
+	kmem_caches = kc;
+	spin_unlock(&kmem_caches_lock);
+}
+
+// Set up the kmalloc caches.
+void
+kmem_init(void)
+{
+	static const char * const names[KMALLOC_NCLASS] = {
+		"kmalloc-32", "kmalloc-64", "kmalloc-128",
+		"kmalloc-256", "kmalloc-512", "kmalloc-1024",
+	};
+	int i;
+
+	spin_initlock(kmem_caches_lock);
+	cache_init(&cache_cache, "kmem_cache", sizeof(struct Kmem_cache),
+		   0, NULL);
+	for (i = 0; i < KMALLOC_NCLASS; i++)
+		if (!(kmalloc_caches[i] = kmem_cache_create(names[i],
+						KMALLOC_MIN << i, 0, NULL)))
+			panic("kmem_init: out of memory");
+
+	check_kmem();
+}
+
+//
+// Create a cache of 'size'-byte objects aligned to 'align' (0 for the
+// default, see kern/slab.h).  'ctor', if not NULL, is run on each new
+// object.  'name' is kept for the statistics and must not be freed.
+// Returns NULL if out of memory.
+//
+struct Kmem_cache *
+kmem_cache_create(const char *name, size_t size, size_t align,
+		  void (*ctor)(void *))
+{
+	struct Kmem_cache *kc;
+
+	if ((kc = kmem_cache_alloc(&cache_cache)) != NULL)
+		cache_init(kc, name, size, align, ctor);
+	return kc;
+}
+
+// Destroy a cache whose objects have all been freed.
+void
+kmem_cache_destroy(struct Kmem_cache *kc)
+{
+	struct Kmem_cache **kcp;
+	struct Slab *s;
+
+	if (kc->kc_inuse)
+		panic("kmem_cache_destroy: %s still has %u objects",
+		      kc->kc_name, kc->kc_inuse);
+	while ((s = kc->kc_partial) != NULL) {
+		slab_remove(s);
+		page_free(pa2page(PADDR(s)));
+	}
+	spin_lock(&kmem_caches_lock);
+	for (kcp = &kmem_caches; *kcp != kc; kcp = &(*kcp)->kc_next)
+		/* do nothing */;
+	*kcp = kc->kc_next;
+	spin_unlock(&kmem_caches_lock);
+	spin_destroylock(&kc->kc_lock);
+	kmem_cache_free(&cache_cache, kc);
+}
+
+// Add a slab of new, constructed objects to the front of kc_partial.
+static struct Slab *
+slab_create(struct Kmem_cache *kc)
+{
+	struct PageInfo *pp;
+	struct Slab *s;
+	uint32_t i;
+
+	if (!(pp = page_alloc(0)))
+		return NULL;
+	s = page2kva(pp);
+	s->s_cache = kc;
+	s->s_mem = (uint8_t *) s + kc->kc_offset;
+	s->s_inuse = 0;
+	s->s_free = 0;
+	for (i = 0; i < kc->kc_perslab; i++) {
+		s->s_link[i] = i + 1 < kc->kc_perslab ? i + 1 : SLAB_NONE;
+		if (kc->kc_ctor)
+			kc->kc_ctor(s->s_mem + i * kc->kc_size);
+	}
+	kc->kc_nslabs++;
+	kc->kc_nempty++;
+	slab_insert(&kc->kc_partial, s);
+	return s;
+}
+
+// Allocate an object from 'kc'.  Returns NULL if out of memory.
+void *
+kmem_cache_alloc(struct Kmem_cache *kc)
+{
+	struct Slab *s;
+	void *obj;
+
+	spin_lock(&kc->kc_lock);
+	if ((s = kc->kc_partial) != NULL)
+		kc->kc_hits++;
+	else if ((s = slab_create(kc)) != NULL)
+		kc->kc_misses++;
+	else {
+		spin_unlock(&kc->kc_lock);
+		return NULL;
+	}
+
+	if (s->s_inuse++ == 0)
+		kc->kc_nempty--;
+	obj = s->s_mem + s->s_free * kc->kc_size;
+	s->s_free = s->s_link[s->s_free];
+	if (s->s_free == SLAB_NONE) {
+		slab_remove(s);
+		slab_insert(&kc->kc_full, s);
+	}
+	kc->kc_inuse++;
+	spin_unlock(&kc->kc_lock);
+	return obj;
+}
+
+// Return 'obj' to 'kc', in its constructed state.
+void
+kmem_cache_free(struct Kmem_cache *kc, void *obj)
+{
+	struct Slab *s = ROUNDDOWN(obj, PGSIZE);
+	uint32_t i = ((uint8_t *) obj - s->s_mem) / kc->kc_size;
+
+	spin_lock(&kc->kc_lock);
+	if (s->s_cache != kc || i >= kc->kc_perslab
+	    || s->s_mem + i * kc->kc_size != obj || s->s_inuse == 0)
+		panic("kmem_cache_free: %08x is not a %s object",
+		      obj, kc->kc_name);
+
+	s->s_link[i] = s->s_free;
+	s->s_free = i;
+	kc->kc_inuse--;
+	kc->kc_frees++;
+
+	// Move the slab to the front, so that this object is next.
+	slab_remove(s);
+	if (--s->s_inuse > 0 || kc->kc_nempty == 0) {
+		if (s->s_inuse == 0)
+			kc->kc_nempty++;
+		slab_insert(&kc->kc_partial, s);
+	} else {
+		kc->kc_nslabs--;
+		page_free(pa2page(PADDR(s)));
+	}
+	spin_unlock(&kc->kc_lock);
+}
+
+//
+// Allocate 'size' bytes from the smallest kmalloc cache that fits,
+// or, above KMEM_MAXOBJ, a page-aligned block from the page allocator.
+// Returns NULL if out of memory.
+//
+void *
+kmalloc(size_t size)
+{
+	struct PageInfo *pp;
+	int i;
+
+	if (size == 0)
+		return NULL;
+	if (size <= KMEM_MAXOBJ) {
+		for (i = 0; (KMALLOC_MIN << i) < size; i++)
+			/* do nothing */;
+		return kmem_cache_alloc(kmalloc_caches[i]);
+	}
+
+	for (i = 0; (PGSIZE << i) < size; i++)
+		/* do nothing */;
+	if (i >= NPAGEORDER || !(pp = page_alloc_order(i, 0)))
+		return NULL;
+	return page2kva(pp);
+}
+
+// Free memory from kmalloc.  Only blocks from the page allocator
+// are page-aligned: slab objects sit behind the slab header.
+void
+kfree(void *p)
+{
+	struct PageInfo *pp;
+	struct Slab *s;
+
+	if (p == NULL)
+		return;
+	if (PGOFF(p) == 0) {
+		pp = pa2page(PADDR(p));
+		page_free_order(pp, pp->pp_order);
+	} else {
+		s = ROUNDDOWN(p, PGSIZE);
+		kmem_cache_free(s->s_cache, p);
+	}
+}
+
+void
+kmem_print_stats(void)
+{
+	struct Kmem_cache *kc;
+	uint32_t nalloc;
+
+	cprintf("cache          size perslab slabs  inuse     allocs   frees hit%%\n");
+	spin_lock(&kmem_caches_lock);
+	for (kc = kmem_caches; kc; kc = kc->kc_next) {
+		nalloc = kc->kc_hits + kc->kc_misses;
+		cprintf("%-14s %4u %7u %5u %6u %10u %7u %3u%%\n",
+			kc->kc_name, kc->kc_size, kc->kc_perslab,
+			kc->kc_nslabs, kc->kc_inuse, nalloc, kc->kc_frees,
+			nalloc ? (uint32_t) ((uint64_t) kc->kc_hits * 100 / nalloc) : 0);
+	}
+	spin_unlock(&kmem_caches_lock);
+}
+
+
+// --------------------------------------------------------------
+// Checking functions.
+// --------------------------------------------------------------
+
+static int check_nctor;
+
+static void
+check_ctor(void *obj)
+{
+	*(uint32_t *) obj = 0xC0FFEE;
+	check_nctor++;
+}
+
+static void
+check_kmem(void)
+{
+	struct Kmem_cache *kc;
+	void *obj[64], *p, *q;
+	int i;
+
+	assert((kc = kmem_cache_create("check", 100, 0, check_ctor)));
+	assert(kc->kc_size == 128 && kc->kc_align == CACHELINE);
+	for (i = 0; i < ARRAY_SIZE(obj); i++) {
+		assert((obj[i] = kmem_cache_alloc(kc)) != NULL);
+		assert(((uintptr_t) obj[i] & (CACHELINE - 1)) == 0);
+		assert(*(uint32_t *) obj[i] == 0xC0FFEE);
+	}
+	assert(check_nctor == kc->kc_nslabs * kc->kc_perslab);
+
+	// a freed object is the next one handed out, still constructed
+	kmem_cache_free(kc, obj[10]);
+	assert(kmem_cache_alloc(kc) == obj[10]);
+	assert(*(uint32_t *) obj[10] == 0xC0FFEE);
+
+	// all but one empty slab go back to the page allocator
+	for (i = 0; i < ARRAY_SIZE(obj); i++)
+		kmem_cache_free(kc, obj[i]);
+	assert(kc->kc_inuse == 0 && kc->kc_nslabs == 1);
+	kmem_cache_destroy(kc);
+
+	// kmalloc
+	assert((p = kmalloc(40)) && ((uintptr_t) p & 63) == 0);
+	assert((q = kmalloc(3 * PGSIZE)) && PGOFF(q) == 0);
+	memset(q, 0, 3 * PGSIZE);
+	kfree(p);
+	kfree(q);
+
+	cprintf("check_kmem() succeeded!\n");
+}
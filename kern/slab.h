@@ -0,0 +1,35 @@
+#ifndef JOS_KERN_SLAB_H
+#define JOS_KERN_SLAB_H
+#ifndef JOS_KERNEL
+# error "This is a JOS kernel header; user programs should not #include it"
+#endif
+
+#include <inc/types.h>
+
+// A cache of fixed-size objects, carved out of one-page slabs.
+// Objects are aligned to 'align', or by default to the cache line or
+// their size rounded up to a power of two, whichever is smaller, so
+// no object straddles more cache lines than it must.
+//
+// If there is a constructor, it runs once per object when its slab
+// is created; objects must be freed in their constructed state.
+struct Kmem_cache;
+
+// Largest object a cache can hold; kmalloc takes larger sizes
+// straight from the page allocator.
+#define KMEM_MAXOBJ	1024
+
+void	kmem_init(void);
+
+struct Kmem_cache *kmem_cache_create(const char *name, size_t size,
+				     size_t align, void (*ctor)(void *));
+void	*kmem_cache_alloc(struct Kmem_cache *kc);
+void	kmem_cache_free(struct Kmem_cache *kc, void *obj);
+void	kmem_cache_destroy(struct Kmem_cache *kc);
+
+void	*kmalloc(size_t size);
+void	kfree(void *p);
+
+void	kmem_print_stats(void);
+
+#endif /* !JOS_KERN_SLAB_H */
@@ -0,0 +1,276 @@
+// Mutual exclusion spin locks: ticket locks and MCS queue locks.
+//
+// With DEBUG_SPINLOCK, every lock initialized with spin_initlock or
+// mcs_initlock is on a list of all locks, and records how often it was
+// taken, how often and how long acquirers spun, and where its holder
+// took it.  The 'locks' monitor command prints the most contended.
+
+#include <inc/types.h>
+#include <inc/assert.h>
+#include <inc/x86.h>
+#include <inc/atomic.h>
+#include <inc/memlayout.h>
+#include <inc/string.h>
+#include <inc/stdio.h>
+
+#include <kern/cpu.h>
+#include <kern/spinlock.h>
+#include <kern/kdebug.h>
+
+#ifdef DEBUG_SPINLOCK
+// The list of all locks, and a lock for it that is not on it.
+static struct Lockstat *lockstats;
+static struct spinlock lockstat_lock;
+
+static void
+lockstat_init(struct Lockstat *ls, const char *name)
+{
+	memset(ls, 0, sizeof(*ls));
+	ls->ls_name = name;
+	spin_lock(&lockstat_lock);
+	ls->ls_next = lockstats;
+	lockstats = ls;
+	spin_unlock(&lockstat_lock);
+}
+
+static void
+lockstat_remove(struct Lockstat *ls)
+{
+	struct Lockstat **lsp;
+
+	spin_lock(&lockstat_lock);
+	for (lsp = &lockstats; *lsp; lsp = &(*lsp)->ls_next)
+		if (*lsp == ls) {
+			*lsp = ls->ls_next;
+			break;
+		}
+	spin_unlock(&lockstat_lock);
+}
+
+// Record an acquisition at 'eip'.  't0' is when the acquirer started
+// to spin, or 0 if it didn't have to.
+static void
+lockstat_acquired(struct Lockstat *ls, uintptr_t eip, uint64_t t0)
+{
+	ls->ls_cpu = thiscpu;
+	ls->ls_eip = eip;
+	ls->ls_nacquire++;
+	if (t0) {
+		ls->ls_ncontend++;
+		ls->ls_spin += read_tsc() - t0;
+	}
+}
+#endif
+
+
+// --------------------------------------------------------------
+// Ticket locks
+// --------------------------------------------------------------
+
+#ifdef DEBUG_SPINLOCK
+// Check whether this CPU is holding the lock.
+static bool
+spin_holding(struct spinlock *lk)
+{
+	return lk->owner != lk->next && lk->stat.ls_cpu == thiscpu;
+}
+#endif
+
+void
+__spin_initlock(struct spinlock *lk, const char *name)
+{
+	lk->owner = lk->next = 0;
+#ifdef DEBUG_SPINLOCK
+	lockstat_init(&lk->stat, name);
+#endif
+}
+
+// Take a lock off the list of all locks before its memory goes away.
+void
+spin_destroylock(struct spinlock *lk)
+{
+#ifdef DEBUG_SPINLOCK
+	if (lk->owner != lk->next)
+		panic("spin_destroylock: %s is held", lk->stat.ls_name);
+	lockstat_remove(&lk->stat);
+#endif
+}
+
+// Acquire the lock.
+// Loops (spins) until the lock is acquired.
+// Holding a lock for a long time may cause
+// other CPUs to waste time spinning to acquire it.
+void
+spin_lock(struct spinlock *lk)
+{
+	uint16_t ticket;
+	uint64_t t0 = 0;
+
+#ifdef DEBUG_SPINLOCK
+	if (spin_holding(lk))
+		panic("CPU %d cannot acquire %s: already holding",
+		      cpunum(), lk->stat.ls_name);
+#endif
+
+	// The locked xadd is a full barrier, so nothing from the
+	// critical section moves above it.
+	ticket = atomic_fetch_add(&lk->next, 1);
+	if (lk->owner != ticket) {
+#ifdef DEBUG_SPINLOCK
+		t0 = read_tsc();
+#endif
+		while (lk->owner != ticket)
+			cpu_relax();
+	}
+
+#ifdef DEBUG_SPINLOCK
+	lockstat_acquired(&lk->stat, (uintptr_t) __builtin_return_address(0),
+			  t0);
+#endif
+}
+
+// Release the lock.
+void
+spin_unlock(struct spinlock *lk)
+{
+#ifdef DEBUG_SPINLOCK
+	if (!spin_holding(lk))
+		panic("CPU %d cannot release %s: not holding",
+		      cpunum(), lk->stat.ls_name);
+	lk->stat.ls_cpu = NULL;
+#endif
+
+	// Only the holder writes 'owner', so a plain store hands the
+	// lock to the next ticket, once the critical section is done.
+	store_release(&lk->owner, lk->owner + 1);
+}
+
+
+// --------------------------------------------------------------
+// MCS queue locks
+// --------------------------------------------------------------
+
+#ifdef DEBUG_SPINLOCK
+static bool
+mcs_holding(struct mcs_lock *lk)
+{
+	return lk->tail != NULL && lk->stat.ls_cpu == thiscpu;
+}
+#endif
+
+void
+__mcs_initlock(struct mcs_lock *lk, const char *name)
+{
+	lk->tail = NULL;
+#ifdef DEBUG_SPINLOCK
+	lockstat_init(&lk->stat, name);
+#endif
+}
+
+// Acquire the lock, queueing 'node' behind the current waiters.
+void
+mcs_lock(struct mcs_lock *lk, struct mcs_node *node)
+{
+	struct mcs_node *prev;
+	uint64_t t0 = 0;
+
+#ifdef DEBUG_SPINLOCK
+	if (mcs_holding(lk))
+		panic("CPU %d cannot acquire %s: already holding",
+		      cpunum(), lk->stat.ls_name);
+#endif
+
+	node->next = NULL;
+	node->locked = 1;
+	prev = atomic_xchg(&lk->tail, node);
+	if (prev) {
+#ifdef DEBUG_SPINLOCK
+		t0 = read_tsc();
+#endif
+		// The previous waiter clears node->locked when it is done.
+		prev->next = node;
+		while (node->locked)
+			cpu_relax();
+	}
+
+#ifdef DEBUG_SPINLOCK
+	lockstat_acquired(&lk->stat, (uintptr_t) __builtin_return_address(0),
+			  t0);
+#endif
+}
+
+// Release the lock taken with 'node', handing it to the next waiter.
+void
+mcs_unlock(struct mcs_lock *lk, struct mcs_node *node)
+{
+#ifdef DEBUG_SPINLOCK
+	if (!mcs_holding(lk))
+		panic("CPU %d cannot release %s: not holding",
+		      cpunum(), lk->stat.ls_name);
+	lk->stat.ls_cpu = NULL;
+#endif
+
+	if (!node->next) {
+		// No known successor: free the lock, unless someone
+		// swapped themselves into the tail meanwhile.
+		if (atomic_cmpxchg(&lk->tail, node, NULL) == node)
+			return;
+		// They will link in shortly.
+		while (!node->next)
+			cpu_relax();
+	}
+	store_release(&node->next->locked, 0);
+}
+
+
+// --------------------------------------------------------------
+// Statistics
+// --------------------------------------------------------------
+
+#define NLOCKSTAT	64	// most locks lock_print_stats prints
+
+// Print the 'n' locks that spent the most cycles spinning, with the
+// place each was last taken and the CPU that holds it, if any.
+void
+lock_print_stats(int n)
+{
+#ifdef DEBUG_SPINLOCK
+	struct Lockstat *top[NLOCKSTAT], *ls;
+	struct Eipdebuginfo info;
+	int ntop, i;
+
+	n = MIN(n, NLOCKSTAT);
+	ntop = 0;
+	spin_lock(&lockstat_lock);
+	// Insertion sort into top[], most spin cycles first.
+	for (ls = lockstats; ls && n > 0; ls = ls->ls_next) {
+		if (ntop == n && top[n - 1]->ls_spin >= ls->ls_spin)
+			continue;
+		if (ntop < n)
+			ntop++;
+		for (i = ntop - 1; i > 0 && top[i - 1]->ls_spin < ls->ls_spin; i--)
+			top[i] = top[i - 1];
+		top[i] = ls;
+	}
+
+	cprintf("lock                 acquired  contended   spin cycles  avg spin  last taken at\n");
+	for (i = 0; i < ntop; i++) {
+		ls = top[i];
+		cprintf("%-20s %8u %10u %13llu %9llu", ls->ls_name,
+			ls->ls_nacquire, ls->ls_ncontend, ls->ls_spin,
+			ls->ls_ncontend ? ls->ls_spin / ls->ls_ncontend : 0);
+		if (ls->ls_eip && debuginfo_eip(ls->ls_eip, &info) == 0)
+			cprintf("  %s:%d: %.*s+%d", info.eip_file, info.eip_line,
+				info.eip_fn_namelen, info.eip_fn_name,
+				ls->ls_eip - info.eip_fn_addr);
+		else if (ls->ls_eip)
+			cprintf("  %08x", ls->ls_eip);
+		if (ls->ls_cpu)
+			cprintf(" (held by CPU %d)", ls->ls_cpu->cpu_id);
+		cprintf("\n");
+	}
+	spin_unlock(&lockstat_lock);
+#else
+	cprintf("Lock statistics need DEBUG_SPINLOCK (kern/spinlock.h)\n");
+#endif
+}
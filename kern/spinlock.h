@@ -0,0 +1,70 @@
+#ifndef JOS_KERN_SPINLOCK_H
+#define JOS_KERN_SPINLOCK_H
+#ifndef JOS_KERNEL
+# error "This is a JOS kernel header; user programs should not #include it"
+#endif
+
+#include <inc/types.h>
+
+// Comment this to disable spinlock debugging
+#define DEBUG_SPINLOCK
+
+#ifdef DEBUG_SPINLOCK
+// Statistics for one lock, updated by the holder.
+struct Lockstat {
+	const char *ls_name;		// Name of lock
+	struct CpuInfo *ls_cpu;		// The CPU holding the lock
+	uintptr_t ls_eip;		// Where it was last acquired
+	uint32_t ls_nacquire;		// Acquisitions
+	uint32_t ls_ncontend;		// Acquisitions that had to wait
+	uint64_t ls_spin;		// TSC cycles spent waiting
+	struct Lockstat *ls_next;	// On the list of all locks
+};
+#endif
+
+// Ticket lock.  Each acquirer takes the next ticket and spins until
+// 'owner' reaches it, so the lock is handed out in FIFO order and
+// waiters don't fight over the cache line with atomic operations.
+struct spinlock {
+	volatile uint16_t owner;	// Ticket being served
+	volatile uint16_t next;		// Next ticket to hand out
+
+#ifdef DEBUG_SPINLOCK
+	struct Lockstat stat;
+#endif
+};
+
+// MCS queue lock.  Waiters queue up through nodes they supply, usually
+// on their stack, and each spins on its own node, so a release
+// touches only the next waiter's cache line.  The node must stay put
+// until the matching mcs_unlock.
+struct mcs_node {
+	struct mcs_node *volatile next;
+	volatile uint32_t locked;
+};
+
+struct mcs_lock {
+	struct mcs_node *volatile tail;	// Last waiter, or NULL if free
+
+#ifdef DEBUG_SPINLOCK
+	struct Lockstat stat;
+#endif
+};
+
+void __spin_initlock(struct spinlock *lk, const char *name);
+void spin_destroylock(struct spinlock *lk);
+void spin_lock(struct spinlock *lk);
+void spin_unlock(struct spinlock *lk);
+
+// Initialize a lock named after the variable: spin_initlock(page_lock).
+#define spin_initlock(lock)   __spin_initlock(&(lock), #lock)
+
+void __mcs_initlock(struct mcs_lock *lk, const char *name);
+void mcs_lock(struct mcs_lock *lk, struct mcs_node *node);
+void mcs_unlock(struct mcs_lock *lk, struct mcs_node *node);
+
+#define mcs_initlock(lock)    __mcs_initlock(&(lock), #lock)
+
+void lock_print_stats(int n);
+
+#endif
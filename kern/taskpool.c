@@ -0,0 +1,211 @@
+// Work-stealing task pool: one Chase-Lev deque per CPU (inc/lockfree.h).
+//
+// Forking pushes a task on this CPU's deque.  Joining pops tasks off
+// it and runs them until the one joined is done; if a thief took that
+// one, the joiner steals from the other deques while it waits instead
+// of idling.  Idle workers spin with exponential backoff: there are no
+// interrupts yet to wake a halted CPU.
+
+#include <inc/types.h>
+#include <inc/assert.h>
+#include <inc/atomic.h>
+#include <inc/lockfree.h>
+#include <inc/stdio.h>
+
+#include <kern/cpu.h>
+#include <kern/taskpool.h>
+
+#define TASKQ_SIZE	256		// tasks per deque, a power of two
+#define TASK_BACKOFF	1024		// longest idle spin, in pauses
+
+struct TaskQueue {
+	struct ws_deque tq_deque;
+	void *tq_slots[TASKQ_SIZE];
+	// Statistics, written only by the queue's CPU
+	uint32_t tq_nrun;		// Tasks run by this CPU
+	uint32_t tq_nsteal;		// ... of which stolen from others
+	uint32_t tq_ninline;		// Forks run at once, deque full
+} __attribute__((aligned(CACHELINE)));
+
+static struct TaskQueue taskqs[NCPU];
+static volatile uint32_t nworkers;	// CPUs in taskpool_worker
+
+void
+taskpool_init(void)
+{
+	int i;
+
+	for (i = 0; i < NCPU; i++)
+		ws_deque_init(&taskqs[i].tq_deque, taskqs[i].tq_slots,
+			      TASKQ_SIZE);
+}
+
+// The number of APs taking tasks.
+int
+taskpool_nworkers(void)
+{
+	return nworkers;
+}
+
+static void
+task_run(struct TaskQueue *q, struct Task *t)
+{
+	q->tq_nrun++;
+	t->t_func(t->t_arg);
+	// 't' may be gone as soon as its joiner sees this.
+	store_release(&t->t_done, 1);
+}
+
+// Steal a task from some other CPU, trying each once, starting after
+// this one so that thieves spread over their victims.
+static struct Task *
+task_steal(int me)
+{
+	struct Task *t;
+	int i, v;
+
+	for (i = 1; i < ncpu; i++) {
+		v = (me + i) % ncpu;
+		if ((t = ws_deque_steal(&taskqs[v].tq_deque))) {
+			taskqs[me].tq_nsteal++;
+			return t;
+		}
+	}
+	return NULL;
+}
+
+void
+task_fork(struct Task *t, void (*func)(void *), void *arg)
+{
+	struct TaskQueue *q = &taskqs[cpunum()];
+
+	t->t_func = func;
+	t->t_arg = arg;
+	t->t_done = 0;
+	if (!ws_deque_push(&q->tq_deque, t)) {
+		q->tq_ninline++;
+		task_run(q, t);
+	}
+}
+
+void
+task_join(struct Task *t)
+{
+	int me = cpunum();
+	struct TaskQueue *q = &taskqs[me];
+	struct Task *other;
+
+	while (!load_acquire(&t->t_done)) {
+		// Joins usually come in reverse order of the forks, so
+		// our newest task is most likely 't' itself.
+		if ((other = ws_deque_pop(&q->tq_deque))
+		    || (other = task_steal(me)))
+			task_run(q, other);
+		else
+			cpu_relax();
+	}
+}
+
+// Run tasks for as long as the machine is up.  Called by each AP
+// once it is set up.
+void
+taskpool_worker(void)
+{
+	int me = cpunum();
+	struct TaskQueue *q = &taskqs[me];
+	struct Task *t;
+	uint32_t backoff = 1, i;
+
+	atomic_add(&nworkers, 1);
+	for (;;) {
+		// A worker only forks from inside a task, and joins
+		// those before it returns, so its deque is empty here.
+		if ((t = task_steal(me))) {
+			task_run(q, t);
+			backoff = 1;
+			continue;
+		}
+		for (i = 0; i < backoff; i++)
+			cpu_relax();
+		if (backoff < TASK_BACKOFF)
+			backoff <<= 1;
+	}
+}
+
+void
+taskpool_print_stats(void)
+{
+	struct TaskQueue *q;
+	int i;
+
+	cprintf("cpu      run   stolen   inline\n");
+	for (i = 0; i < ncpu; i++) {
+		q = &taskqs[i];
+		cprintf("%3d %8u %8u %8u\n", i, q->tq_nrun, q->tq_nsteal,
+			q->tq_ninline);
+	}
+}
+
+
+// --------------------------------------------------------------
+// Parallel loops
+// --------------------------------------------------------------
+
+struct ParFor {
+	void (*pf_func)(void *arg, uint32_t lo, uint32_t hi);
+	void *pf_arg;
+	uint32_t pf_grain;
+};
+
+struct ParForRange {
+	struct ParFor *pr_pf;
+	uint32_t pr_lo, pr_hi;
+};
+
+// Split the range in two until the pieces are small enough: fork the
+// upper half, which a thief takes whole and splits further, and go on
+// with the lower half here.
+static void
+parallel_for_range(void *arg)
+{
+	struct ParForRange *r = arg, upper;
+	struct ParFor *pf = r->pr_pf;
+	struct Task t;
+	uint32_t mid;
+
+	if (r->pr_hi - r->pr_lo <= pf->pf_grain) {
+		pf->pf_func(pf->pf_arg, r->pr_lo, r->pr_hi);
+		return;
+	}
+	mid = r->pr_lo + (r->pr_hi - r->pr_lo) / 2;
+	upper.pr_pf = pf;
+	upper.pr_lo = mid;
+	upper.pr_hi = r->pr_hi;
+	task_fork(&t, parallel_for_range, &upper);
+	r->pr_hi = mid;
+	parallel_for_range(r);
+	task_join(&t);
+}
+
+void
+task_parallel_for(uint32_t lo, uint32_t hi, uint32_t grain,
+		  void (*func)(void *arg, uint32_t lo, uint32_t hi), void *arg)
+{
+	struct ParFor pf;
+	struct ParForRange r;
+
+	if (lo >= hi)
+		return;
+	// Nobody to share with: skip the splitting.
+	if (nworkers == 0) {
+		func(arg, lo, hi);
+		return;
+	}
+	pf.pf_func = func;
+	pf.pf_arg = arg;
+	pf.pf_grain = MAX(grain, 1);
+	r.pr_pf = &pf;
+	r.pr_lo = lo;
+	r.pr_hi = hi;
+	parallel_for_range(&r);
+}
@@ -0,0 +1,40 @@
+#ifndef JOS_KERN_TASKPOOL_H
+#define JOS_KERN_TASKPOOL_H
+#ifndef JOS_KERNEL
+# error "This is a JOS kernel header; user programs should not #include it"
+#endif
+
+#include <inc/types.h>
+
+// A work-stealing pool for parallel kernel jobs.  Each CPU has a deque
+// of forked tasks; it runs its own newest task first, and a CPU with
+// nothing to do steals the oldest task from another CPU's deque.  The
+// APs run taskpool_worker once they are up; until then, and on a
+// uniprocessor, forked tasks simply run on the CPU that joins them.
+//
+// A Task belongs to the caller, usually on its stack, and must stay
+// put until task_join returns.  Don't fork or join while holding a
+// spinlock: the joining CPU runs other tasks while it waits, and any
+// of them may want the same lock.
+struct Task {
+	void (*t_func)(void *);
+	void *t_arg;
+	volatile uint32_t t_done;
+};
+
+void	taskpool_init(void);
+void	taskpool_worker(void) __attribute__((noreturn));
+int	taskpool_nworkers(void);
+void	taskpool_print_stats(void);
+
+void	task_fork(struct Task *t, void (*func)(void *), void *arg);
+void	task_join(struct Task *t);
+
+// Call func(arg, lo', hi') on pieces of [lo, hi) in parallel, and
+// return when all are done.  The range is split down to pieces of
+// 'grain' items; with no workers, func gets it whole.
+void	task_parallel_for(uint32_t lo, uint32_t hi, uint32_t grain,
+			  void (*func)(void *arg, uint32_t lo, uint32_t hi),
+			  void *arg);
+
+#endif /* !JOS_KERN_TASKPOOL_H */
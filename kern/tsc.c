@@ -0,0 +1,43 @@
+// Time stamp counter calibration against the 8253/8254 PIT.
+
+#include <inc/x86.h>
+
+#include <kern/tsc.h>
+
+#define PIT_HZ		1193182	// PIT input clock
+#define PIT_CH2		0x42	// channel 2 data port (speaker)
+#define PIT_MODE	0x43	// mode/command register
+#define KBC_PORTB	0x61	// channel 2 gate (bit 0) and output (bit 5)
+
+#define CAL_MS		10	// length of the calibration interval
+
+uint32_t tsc_khz;
+
+// Count TSC ticks while PIT channel 2 counts down CAL_MS milliseconds
+// in mode 0 (interrupt on terminal count) with the speaker off.
+void
+tsc_calibrate(void)
+{
+	uint32_t latch = PIT_HZ / (1000 / CAL_MS);
+	uint64_t t0, t1;
+
+	outb(KBC_PORTB, (inb(KBC_PORTB) & ~0x02) | 0x01);
+	outb(PIT_MODE, 0xB0);	// channel 2, lobyte/hibyte, mode 0, binary
+	outb(PIT_CH2, latch & 0xFF);
+	outb(PIT_CH2, latch >> 8);
+
+	t0 = read_tsc();
+	while (!(inb(KBC_PORTB) & 0x20))
+		/* do nothing */;
+	t1 = read_tsc();
+
+	tsc_khz = (t1 - t0) / CAL_MS;
+}
+
+uint64_t
+tsc_to_us(uint64_t cycles)
+{
+	if (tsc_khz == 0)
+		return 0;
+	return cycles * 1000 / tsc_khz;
+}
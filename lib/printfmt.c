@@ -80,18 +80,26 @@ getint(va_list *ap, int lflag)
 void printfmt(void (*putch)(int, void*), void *putdat, const char *fmt, ...);
 
 void
-vprintfmt(void (*putch)(int, void*), void *putdat, const char *fmt, va_list ap)
+vprintfmt(void (*putch)(int, void*), void *putdat, const char *fmt, va_list ap_in)
 {
 	register const char *p;
 	register int ch, err;
 	unsigned long long num;
 	int base, lflag, width, precision, altflag;
 	char padc;
+	va_list ap;
 
+	// getuint and getint take the address of a local copy: where
+	// va_list is an array type (x86-64, for the host build), the
+	// parameter is really a pointer, and &ap_in would not be a
+	// va_list *.
+	va_copy(ap, ap_in);
 	while (1) {
 		while ((ch = *(unsigned char *) fmt++) != '%') {
-			if (ch == '\0')
+			if (ch == '\0') {
+				va_end(ap);
 				return;
+			}
 			putch(ch, putdat);
 		}
 
@@ -1,6 +1,7 @@
-// Basic string routines.  Not hardware optimized, but not shabby.
+// Basic string routines, a word or more at a time where that pays.
 
 #include <inc/string.h>
+#include <inc/x86.h>
 
 // Using assembly for memset/memmove
 // makes some difference on real hardware,
@@ -8,24 +9,80 @@
 // Primespipe runs 3x faster this way.
 #define ASM 1
 
+// The string scans below go a 32-bit word at a time once the pointer
+// is word-aligned.  An aligned word never straddles a page, so reading
+// the whole word holding the terminator is safe even when the bytes
+// after it are unmapped.  Words are read through a may_alias type so
+// the compiler doesn't assume they can't alias the caller's chars.
+typedef uint32_t __attribute__((__may_alias__)) word_t;
+// For memcmp and memfind, which read words at any alignment, but only
+// inside the buffers.
+typedef uint32_t __attribute__((__may_alias__, __aligned__(1))) uword_t;
+
+#define WORD_ALIGNED(p)	(((uintptr_t) (p) & (sizeof(word_t) - 1)) == 0)
+#define ONES		0x01010101U
+#define HIGHS		0x80808080U
+
+// Nonzero if some byte of 'w' is zero.  A byte borrows in w - ONES
+// and keeps its high bit in ~w only if it was 0; any byte above a
+// zero byte can come out wrong, but the lowest flagged byte is exact,
+// and we only ask whether there is one.
+#define HASZERO(w)	(((w) - ONES) & ~(w) & HIGHS)
+
+// Does the CPU have the feature?  In the kernel, each test is patched
+// into a NOP or a jmp at boot (inc/alternative.h); elsewhere, it reads
+// the flags given to string_select.
+#ifdef JOS_KERNEL
+#define HAVE(str, feat)	static_cpu_has(feat)
+#else
+static int string_features;
+#define HAVE(str, feat)	(string_features & (str))
+
+// Outside the kernel, say which features the CPU has and the OS
+// supports.  Call it before any other thread is copying.
+void
+string_select(int features)
+{
+	string_features = features;
+}
+#endif
+
+// The SSE2 code names xmm registers, which the target attribute
+// allows without letting the compiler use SSE anywhere else.  The
+// caller must have enabled SSE (CR4_OSFXSR); xmm0-3 are not saved.
+#define SSE2_FUNC	__attribute__((target("sse2")))
+
 int
 strlen(const char *s)
 {
-	int n;
+	const char *p = s;
+	const word_t *w;
 
-	for (n = 0; *s != '\0'; s++)
-		n++;
-	return n;
+	for (; !WORD_ALIGNED(p); p++)
+		if (*p == '\0')
+			return p - s;
+	for (w = (const word_t *) p; !HASZERO(*w); w++)
+		/* do nothing */;
+	for (p = (const char *) w; *p != '\0'; p++)
+		/* do nothing */;
+	return p - s;
 }
 
 int
 strnlen(const char *s, size_t size)
 {
-	int n;
-
-	for (n = 0; size > 0 && *s != '\0'; s++, size--)
-		n++;
-	return n;
+	const char *p = s;
+	const word_t *w;
+
+	for (; size > 0 && !WORD_ALIGNED(p); p++, size--)
+		if (*p == '\0')
+			return p - s;
+	for (w = (const word_t *) p; size >= sizeof(word_t) && !HASZERO(*w);
+	     w++, size -= sizeof(word_t))
+		/* do nothing */;
+	for (p = (const char *) w; size > 0 && *p != '\0'; p++, size--)
+		/* do nothing */;
+	return p - s;
 }
 
 char *
@@ -79,6 +136,22 @@ strlcpy(char *dst, const char *src, size_t size)
 int
 strcmp(const char *p, const char *q)
 {
+	const word_t *wp, *wq;
+
+	// Words only work if both strings reach alignment together.
+	if (WORD_ALIGNED((uintptr_t) p ^ (uintptr_t) q)) {
+		for (; !WORD_ALIGNED(p); p++, q++)
+			if (!*p || *p != *q)
+				goto bytes;
+		wp = (const word_t *) p;
+		wq = (const word_t *) q;
+		// Equal words hold the same zero byte, if any.
+		for (; *wp == *wq && !HASZERO(*wp); wp++, wq++)
+			/* do nothing */;
+		p = (const char *) wp;
+		q = (const char *) wq;
+	}
+bytes:
 	while (*p && *p == *q)
 		p++, q++;
 	return (int) ((unsigned char) *p - (unsigned char) *q);
@@ -97,13 +170,12 @@ strncmp(const char *p, const char *q, size_t n)
 
 // Return a pointer to the first occurrence of 'c' in 's',
 // or a null pointer if the string has no 'c'.
+// The terminator does not count: strchr(s, '\0') is null.
 char *
 strchr(const char *s, char c)
 {
-	for (; *s; s++)
-		if (*s == c)
-			return (char *) s;
-	return 0;
+	s = strfind(s, c);
+	return *s ? (char *) s : 0;
 }
 
 // Return a pointer to the first occurrence of 'c' in 's',
@@ -111,60 +183,269 @@ strchr(const char *s, char c)
 char *
 strfind(const char *s, char c)
 {
-	for (; *s; s++)
-		if (*s == c)
-			break;
+	const word_t *w;
+	word_t cw;
+
+	for (; !WORD_ALIGNED(s); s++)
+		if (!*s || *s == c)
+			return (char *) s;
+	// A byte of *w equals c where *w ^ cw has a zero byte.
+	cw = (unsigned char) c * ONES;
+	for (w = (const word_t *) s; !HASZERO(*w) && !HASZERO(*w ^ cw); w++)
+		/* do nothing */;
+	for (s = (const char *) w; *s && *s != c; s++)
+		/* do nothing */;
 	return (char *) s;
 }
 
 #if ASM
+// Below this many bytes, aligning costs more than it saves: a single
+// rep movsb/stosb does the lot.
+#define BULK_MIN	16
+// Size classes for the CPU-specific paths: below SSE_MIN, the
+// rep-string code, or a plain rep movsb with FSRM; up to ERMS_MIN, the
+// SSE2 loops if the CPU has SSE2; from there on, a plain rep movsb or
+// stosb with ERMS, or the SSE2 loops.
+#define SSE_MIN		64
+#define ERMS_MIN	2048
+
+// rep movsl/stosl runs at full speed only when the destination is
+// word-aligned, so the rep paths below do the head bytewise up to
+// the destination's next word boundary, the middle by words, and the
+// last 0-3 bytes bytewise.  The source is aligned too when it starts
+// at the same offset within a word, as it usually does.
+
+static void
+fill_rep(char *p, int c, size_t n)
+{
+	size_t head, nw;
+
+	c &= 0xFF;
+	if (n >= BULK_MIN) {
+		head = -(uintptr_t) p & 3;
+		nw = (n - head) / 4;
+		n = (n - head) & 3;
+		asm volatile("cld; rep stosb"
+			     : "+D" (p), "+c" (head) : "a" (c) : "cc", "memory");
+		asm volatile("rep stosl"
+			     : "+D" (p), "+c" (nw) : "a" (c * 0x01010101U)
+			     : "cc", "memory");
+	}
+	asm volatile("cld; rep stosb"
+		     : "+D" (p), "+c" (n) : "a" (c) : "cc", "memory");
+}
+
+// Copy forwards; fine for overlapping buffers only if dst <= src.
+static void
+copy_forward_rep(char *d, const char *s, size_t n)
+{
+	size_t head, nw;
+
+	if (n >= BULK_MIN) {
+		head = -(uintptr_t) d & 3;
+		nw = (n - head) / 4;
+		n = (n - head) & 3;
+		asm volatile("cld; rep movsb"
+			     : "+D" (d), "+S" (s), "+c" (head) : : "cc", "memory");
+		asm volatile("rep movsl"
+			     : "+D" (d), "+S" (s), "+c" (nw) : : "cc", "memory");
+	}
+	asm volatile("cld; rep movsb"
+		     : "+D" (d), "+S" (s), "+c" (n) : : "cc", "memory");
+}
+
+// Copy backwards, from the top down, for dst > src.  'd' and 's'
+// point just past the buffers.  With DF set, each rep movs leaves the
+// pointers one element below the last one it moved, so they are
+// shifted by the element size around the word step.  It is all one
+// asm statement: the compiler assumes DF is clear between statements.
+static void
+copy_backward_rep(char *d, const char *s, size_t n)
+{
+	size_t head = 0, nw = 0;
+
+	if (n >= BULK_MIN) {
+		head = (uintptr_t) d & 3;
+		nw = (n - head) / 4;
+		n = (n - head) & 3;
+	}
+	d--;
+	s--;
+	asm volatile("std\n\t"
+		     "rep movsb\n\t"
+		     "sub $3, %0\n\t"
+		     "sub $3, %1\n\t"
+		     "mov %3, %2\n\t"
+		     "rep movsl\n\t"
+		     "add $3, %0\n\t"
+		     "add $3, %1\n\t"
+		     "mov %4, %2\n\t"
+		     "rep movsb\n\t"
+		     "cld"
+		     : "+D" (d), "+S" (s), "+c" (head)
+		     : "r" (nw), "r" (n)
+		     : "cc", "memory");
+}
+
+// SSE2 paths, for at least SSE_MIN bytes.  They do the bytes up to a
+// 16-byte boundary in dst with the rep code, then 64 bytes per loop
+// with unaligned loads and aligned stores, then the rest with the rep
+// code again.  Each block is loaded whole before any of it is stored,
+// so overlapping buffers work in the same direction as the rep code.
+
+static void SSE2_FUNC
+fill_sse2(char *p, int c, size_t n)
+{
+	size_t head = -(uintptr_t) p & 15, nb;
+
+	fill_rep(p, c, head);
+	p += head;
+	nb = (n - head) / 64;
+	n = (n - head) & 63;
+	if (nb)
+		asm volatile("movd %2, %%xmm0\n\t"
+			     "pshufd $0, %%xmm0, %%xmm0\n"
+			     "1:\n\t"
+			     "movdqa %%xmm0, (%0)\n\t"
+			     "movdqa %%xmm0, 16(%0)\n\t"
+			     "movdqa %%xmm0, 32(%0)\n\t"
+			     "movdqa %%xmm0, 48(%0)\n\t"
+			     "add $64, %0\n\t"
+			     "dec %1\n\t"
+			     "jnz 1b"
+			     : "+r" (p), "+r" (nb)
+			     : "r" ((c & 0xFF) * 0x01010101U)
+			     : "cc", "memory", "xmm0");
+	fill_rep(p, c, n);
+}
+
+static void SSE2_FUNC
+copy_forward_sse2(char *d, const char *s, size_t n)
+{
+	size_t head = -(uintptr_t) d & 15, nb;
+
+	copy_forward_rep(d, s, head);
+	d += head;
+	s += head;
+	nb = (n - head) / 64;
+	n = (n - head) & 63;
+	if (nb)
+		asm volatile("1:\n\t"
+			     "movdqu (%1), %%xmm0\n\t"
+			     "movdqu 16(%1), %%xmm1\n\t"
+			     "movdqu 32(%1), %%xmm2\n\t"
+			     "movdqu 48(%1), %%xmm3\n\t"
+			     "movdqa %%xmm0, (%0)\n\t"
+			     "movdqa %%xmm1, 16(%0)\n\t"
+			     "movdqa %%xmm2, 32(%0)\n\t"
+			     "movdqa %%xmm3, 48(%0)\n\t"
+			     "add $64, %1\n\t"
+			     "add $64, %0\n\t"
+			     "dec %2\n\t"
+			     "jnz 1b"
+			     : "+r" (d), "+r" (s), "+r" (nb)
+			     : : "cc", "memory", "xmm0", "xmm1", "xmm2", "xmm3");
+	copy_forward_rep(d, s, n);
+}
+
+// 'd' and 's' point just past the buffers, as for copy_backward_rep.
+static void SSE2_FUNC
+copy_backward_sse2(char *d, const char *s, size_t n)
+{
+	size_t head = (uintptr_t) d & 15, nb;
+
+	copy_backward_rep(d, s, head);
+	d -= head;
+	s -= head;
+	nb = (n - head) / 64;
+	n = (n - head) & 63;
+	if (nb)
+		asm volatile("1:\n\t"
+			     "sub $64, %1\n\t"
+			     "sub $64, %0\n\t"
+			     "movdqu (%1), %%xmm0\n\t"
+			     "movdqu 16(%1), %%xmm1\n\t"
+			     "movdqu 32(%1), %%xmm2\n\t"
+			     "movdqu 48(%1), %%xmm3\n\t"
+			     "movdqa %%xmm0, (%0)\n\t"
+			     "movdqa %%xmm1, 16(%0)\n\t"
+			     "movdqa %%xmm2, 32(%0)\n\t"
+			     "movdqa %%xmm3, 48(%0)\n\t"
+			     "dec %2\n\t"
+			     "jnz 1b"
+			     : "+r" (d), "+r" (s), "+r" (nb)
+			     : : "cc", "memory", "xmm0", "xmm1", "xmm2", "xmm3");
+	copy_backward_rep(d, s, n);
+}
+
+// With ERMS, the microcode moves whole cache lines for a plain
+// rep movsb/stosb, which beats any loop once the size is large.  (A
+// backward one, with DF set, gets no such help.)
+
+static void
+fill_erms(char *p, int c, size_t n)
+{
+	asm volatile("cld; rep stosb"
+		     : "+D" (p), "+c" (n) : "a" (c) : "cc", "memory");
+}
+
+static void
+copy_forward_erms(char *d, const char *s, size_t n)
+{
+	asm volatile("cld; rep movsb"
+		     : "+D" (d), "+S" (s), "+c" (n) : : "cc", "memory");
+}
+
+static inline void
+copy_forward(char *d, const char *s, size_t n)
+{
+	if (n < SSE_MIN) {
+		if (HAVE(STR_FSRM, FEAT_FSRM))
+			copy_forward_erms(d, s, n);
+		else
+			copy_forward_rep(d, s, n);
+	} else if (n >= ERMS_MIN && HAVE(STR_ERMS, FEAT_ERMS))
+		copy_forward_erms(d, s, n);
+	else if (HAVE(STR_SSE2, FEAT_SSE2))
+		copy_forward_sse2(d, s, n);
+	else
+		copy_forward_rep(d, s, n);
+}
+
 void *
 memset(void *v, int c, size_t n)
 {
-	char *p;
-
-	if (n == 0)
-		return v;
-	if ((int)v%4 == 0 && n%4 == 0) {
-		c &= 0xFF;
-		c = (c<<24)|(c<<16)|(c<<8)|c;
-		asm volatile("cld; rep stosl\n"
-			:: "D" (v), "a" (c), "c" (n/4)
-			: "cc", "memory");
-	} else
-		asm volatile("cld; rep stosb\n"
-			:: "D" (v), "a" (c), "c" (n)
-			: "cc", "memory");
+	if (n < SSE_MIN)
+		fill_rep(v, c, n);
+	else if (n >= ERMS_MIN && HAVE(STR_ERMS, FEAT_ERMS))
+		fill_erms(v, c, n);
+	else if (HAVE(STR_SSE2, FEAT_SSE2))
+		fill_sse2(v, c, n);
+	else
+		fill_rep(v, c, n);
 	return v;
 }
 
 void *
 memmove(void *dst, const void *src, size_t n)
 {
-	const char *s;
-	char *d;
+	const char *s = src;
+	char *d = dst;
 
-	s = src;
-	d = dst;
 	if (s < d && s + n > d) {
-		s += n;
-		d += n;
-		if ((int)s%4 == 0 && (int)d%4 == 0 && n%4 == 0)
-			asm volatile("std; rep movsl\n"
-				:: "D" (d-4), "S" (s-4), "c" (n/4) : "cc", "memory");
+		if (n >= SSE_MIN && HAVE(STR_SSE2, FEAT_SSE2))
+			copy_backward_sse2(d + n, s + n, n);
 		else
-			asm volatile("std; rep movsb\n"
-				:: "D" (d-1), "S" (s-1), "c" (n) : "cc", "memory");
-		// Some versions of GCC rely on DF being clear
-		asm volatile("cld" ::: "cc");
-	} else {
-		if ((int)s%4 == 0 && (int)d%4 == 0 && n%4 == 0)
-			asm volatile("cld; rep movsl\n"
-				:: "D" (d), "S" (s), "c" (n/4) : "cc", "memory");
-		else
-			asm volatile("cld; rep movsb\n"
-				:: "D" (d), "S" (s), "c" (n) : "cc", "memory");
-	}
+			copy_backward_rep(d + n, s + n, n);
+	} else
+		copy_forward(d, s, n);
+	return dst;
+}
+
+void *
+memcpy(void *dst, const void *src, size_t n)
+{
+	copy_forward(dst, src, n);
 	return dst;
 }
 
@@ -203,12 +484,45 @@ memmove(void *dst, const void *src, size_t n)
 
 	return dst;
 }
-#endif
 
 void *
 memcpy(void *dst, const void *src, size_t n)
 {
-	return memmove(dst, src, n);
+	const char *s = src;
+	char *d = dst;
+
+	while (n-- > 0)
+		*d++ = *s++;
+	return dst;
+}
+#endif
+
+// memcmp and memfind go 16 bytes at a time with SSE2 from this size,
+// otherwise 4 at a time, and look at single bytes only in the block
+// holding the answer and after the last whole block.
+#define CMP_SSE_MIN	32
+
+// Return the offset of the first byte that differs between s1 and s2,
+// or, if their whole 16-byte blocks match, the end of the last one.
+static size_t SSE2_FUNC
+memcmp_sse2(const uint8_t *s1, const uint8_t *s2, size_t n)
+{
+	uint32_t mask;
+	size_t i;
+
+	for (i = 0; n - i >= 16; i += 16) {
+		asm("movdqu %1, %%xmm0\n\t"
+		    "movdqu %2, %%xmm1\n\t"
+		    "pcmpeqb %%xmm1, %%xmm0\n\t"
+		    "pmovmskb %%xmm0, %0"
+		    : "=r" (mask)
+		    : "m" (*(const uint8_t (*)[16]) (s1 + i)),
+		      "m" (*(const uint8_t (*)[16]) (s2 + i))
+		    : "xmm0", "xmm1");
+		if (mask != 0xFFFF)
+			return i + __builtin_ctz(~mask);
+	}
+	return i;
 }
 
 int
@@ -216,24 +530,62 @@ memcmp(const void *v1, const void *v2, size_t n)
 {
 	const uint8_t *s1 = (const uint8_t *) v1;
 	const uint8_t *s2 = (const uint8_t *) v2;
+	size_t i = 0;
 
-	while (n-- > 0) {
-		if (*s1 != *s2)
-			return (int) *s1 - (int) *s2;
-		s1++, s2++;
-	}
+	if (n >= CMP_SSE_MIN && HAVE(STR_SSE2, FEAT_SSE2))
+		i = memcmp_sse2(s1, s2, n);
+	for (; n - i >= sizeof(uword_t); i += sizeof(uword_t))
+		if (*(const uword_t *) (s1 + i) != *(const uword_t *) (s2 + i))
+			break;
+	for (; i < n; i++)
+		if (s1[i] != s2[i])
+			return (int) s1[i] - (int) s2[i];
 
 	return 0;
 }
 
+// Return the offset of the first byte equal to 'c', or, if there is
+// none in the whole 16-byte blocks of s, the end of the last one.
+static size_t SSE2_FUNC
+memfind_sse2(const uint8_t *s, int c, size_t n)
+{
+	uint8_t cv __attribute__((vector_size(16)));	// c in every byte
+	uint32_t mask;
+	size_t i;
+
+	asm("movd %1, %0\n\t"
+	    "pshufd $0, %0, %0"
+	    : "=x" (cv) : "r" ((c & 0xFF) * ONES));
+	for (i = 0; n - i >= 16; i += 16) {
+		asm("movdqu %1, %%xmm0\n\t"
+		    "pcmpeqb %2, %%xmm0\n\t"
+		    "pmovmskb %%xmm0, %0"
+		    : "=r" (mask)
+		    : "m" (*(const uint8_t (*)[16]) (s + i)), "x" (cv)
+		    : "xmm0");
+		if (mask)
+			return i + __builtin_ctz(mask);
+	}
+	return i;
+}
+
 void *
 memfind(const void *s, int c, size_t n)
 {
-	const void *ends = (const char *) s + n;
-	for (; s < ends; s++)
-		if (*(const unsigned char *) s == (unsigned char) c)
+	const uint8_t *p = (const uint8_t *) s;
+	word_t cw = (c & 0xFF) * ONES;
+	size_t i = 0;
+
+	if (n >= CMP_SSE_MIN && HAVE(STR_SSE2, FEAT_SSE2))
+		i = memfind_sse2(p, c, n);
+	// A byte of the word equals c where word ^ cw has a zero byte.
+	for (; n - i >= sizeof(uword_t); i += sizeof(uword_t))
+		if (HASZERO(*(const uword_t *) (p + i) ^ cw))
+			break;
+	for (; i < n; i++)
+		if (p[i] == (uint8_t) c)
 			break;
-	return (void *) s;
+	return (void *) (p + i);
 }
 
 long